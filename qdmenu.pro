@@ -13,10 +13,23 @@ INCLUDEPATH += .
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_UP_TO=0x060000 # disables all APIs deprecated in Qt 6.0.0 and earlier
 
+# Free everything on exit instead of leaving it to the kernel, for leak checkers.
+#DEFINES += LEAKCHECK
+
+# shm_open, part of libc since glibc 2.34
+linux: LIBS += -lrt
+
 # Input
-HEADERS += src/config.h src/drw.h src/util.h
-SOURCES += src/drw.cpp \
+HEADERS += src/arena.h src/config.h src/dedup.h src/drw.h src/path.h src/pool.h src/preview.h src/shm.h src/stats.h src/util.h
+SOURCES += src/arena.cpp \
+           src/dedup.cpp \
+           src/drw.cpp \
+           src/path.cpp \
+           src/pool.cpp \
+           src/preview.cpp \
            src/qdmenu.cpp \
+           src/shm.cpp \
+           src/stats.cpp \
            src/util.cpp \
            CMakeFiles/3.26.4/CompilerIdCXX/CMakeCXXCompilerId.cpp
 TRANSLATIONS += CMakeFiles/qdmenu.dir/compiler_depend.ts \
@@ -0,0 +1,154 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "util.h"
+
+#define HEAPCHUNK  (1 << 20)   /* size of heap chunks */
+#define SPILLCHUNK (64 << 20)  /* size of file backed chunks */
+
+typedef struct {
+	char *base;
+	size_t size, used;
+	int mapped;                /* chunk is mmap'd from the spill file */
+} Chunk;
+
+static Chunk *chunks;
+static size_t nchunks, chunksiz;
+static size_t budget, heapused;
+static int spillfd = -1;
+static off_t spilloff;
+
+static int spillopen(void)
+{
+	char path[] = "/tmp/qdmenu.XXXXXX";
+	const char *dir = getenv("TMPDIR");
+	char *tmpl;
+	int fd;
+
+	if (dir && *dir) {
+		tmpl = (char *)ecalloc(1, strlen(dir) + sizeof "/qdmenu.XXXXXX");
+		sprintf(tmpl, "%s/qdmenu.XXXXXX", dir);
+	} else {
+		tmpl = path;
+	}
+	if ((fd = mkstemp(tmpl)) < 0)
+		die("mkstemp %s:", tmpl);
+	unlink(tmpl);
+	if (tmpl != path)
+		free(tmpl);
+	return fd;
+}
+
+static Chunk *newchunk(size_t need)
+{
+	Chunk *c;
+	size_t size;
+
+	if (nchunks == chunksiz) {
+		chunksiz = chunksiz ? chunksiz * 2 : 64;
+		chunks = (Chunk *)erealloc(chunks, chunksiz * sizeof(*chunks));
+	}
+	c = &chunks[nchunks++];
+	c->used = 0;
+	size = MAX(need, (size_t)HEAPCHUNK);
+	if (!budget || heapused + size <= budget) {
+		c->base = (char *)erealloc(NULL, size);
+		c->size = size;
+		c->mapped = 0;
+		heapused += size;
+		return c;
+	}
+	/* over budget: map the next piece of the spill file */
+	size = (MAX(need, (size_t)SPILLCHUNK) + 4095) & ~(size_t)4095;
+	if (spillfd < 0)
+		spillfd = spillopen();
+	if (ftruncate(spillfd, spilloff + size) < 0)
+		die("ftruncate:");
+	c->base = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, spillfd, spilloff);
+	if (c->base == MAP_FAILED)
+		die("mmap:");
+	madvise(c->base, size, MADV_SEQUENTIAL);
+	c->size = size;
+	c->mapped = 1;
+	spilloff += size;
+	return c;
+}
+
+void arena_init(size_t limit)
+{
+	budget = limit;
+}
+
+char *arena_alloc(size_t len)
+{
+	Chunk *c = nchunks ? &chunks[nchunks - 1] : NULL;
+	char *p;
+
+	if (!c || c->size - c->used < len)
+		c = newchunk(len);
+	p = c->base + c->used;
+	c->used += len;
+	return p;
+}
+
+/* copy len bytes of s to the arena and terminate them with a NUL */
+char *arena_add(const char *s, size_t len)
+{
+	char *p = arena_alloc(len + 1);
+
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+void arena_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < nchunks; i++) {
+		if (chunks[i].mapped)
+			munmap(chunks[i].base, chunks[i].size);
+		else
+			free(chunks[i].base);
+	}
+	free(chunks);
+	chunks = NULL;
+	nchunks = chunksiz = heapused = 0;
+	if (spillfd >= 0) {
+		close(spillfd);
+		spillfd = -1;
+		spilloff = 0;
+	}
+}
+
+static int inchunk(size_t i, const char *p)
+{
+	return i < nchunks && p >= chunks[i].base && p < chunks[i].base + chunks[i].used;
+}
+
+void arena_readahead(const char *p, const char **lo, const char **hi)
+{
+	static thread_local size_t last; /* scans run on several threads */
+	size_t i;
+
+	*lo = *hi = p;
+	/* texts are allocated in order, so a scan usually continues in the next chunk */
+	if (inchunk(last + 1, p))
+		i = last + 1;
+	else
+		for (i = 0; i < nchunks && !inchunk(i, p); i++)
+			;
+	if (i == nchunks)
+		return;
+	last = i;
+	*lo = chunks[i].base;
+	*hi = chunks[i].base + chunks[i].used;
+	if (i + 1 < nchunks && chunks[i + 1].mapped)
+		madvise(chunks[i + 1].base, chunks[i + 1].used, MADV_WILLNEED);
+}
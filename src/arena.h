@@ -0,0 +1,18 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Text arena: item texts are packed into large chunks instead of being
+ * allocated one by one. Once budget bytes (0 for no limit) are in use,
+ * further chunks are mapped from an unlinked temporary file, so the kernel
+ * can write them back and drop them under memory pressure. */
+void arena_init(size_t budget);
+char *arena_add(const char *s, size_t len);
+/* len bytes for the caller to fill, e.g. with the texts of many items on
+ * a worker thread */
+char *arena_alloc(size_t len);
+void arena_free(void);
+
+/* Read-ahead for sequential scans: if p lies in a file backed chunk, ask the
+ * kernel to start reading the chunk after it. [*lo, *hi) is set to the chunk
+ * containing p, so callers only need to call again once they leave it.
+ * Scans on several threads may call it at once. */
+void arena_readahead(const char *p, const char **lo, const char **hi);
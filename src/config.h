@@ -12,9 +12,23 @@ static const char *colors[SchemeLast][2] = {
 	[SchemeNorm] = { "#bbbbbb", "#222222" },
 	[SchemeSel] = { "#eeeeee", "#005577" },
 	[SchemeOut] = { "#000000", "#00ffff" },
+	/* only the foreground of the highlight schemes is used */
+	[SchemeNormHighlight] = { "#ffc978", "#222222" },
+	[SchemeSelHighlight] = { "#ffc978", "#005577" },
 };
 /* -l option; if nonzero, dmenu uses vertical list with given number of lines */
 static unsigned int lines      = 0;
+/* memory cap in KiB for rendered rows of the vertical list */
+static unsigned int tilecachekb = 16384;
+/* -P and -Pf options; preview pane width in percent of the window, delay
+ * in milliseconds before a preview is started and memory cap in KiB */
+static unsigned int previewwidth = 50;
+static unsigned int previewdelay = 80;
+static unsigned int previewcachekb = 8192;
+/* memory cap in KiB for the matches of queries one keystroke ahead */
+static unsigned int speccachekb = 4096;
+/* print the marked items in match order instead of input order */
+static int markorder = 0;
 
 /*
  * Characters not considered part of a word while deleting words
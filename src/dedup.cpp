@@ -0,0 +1,97 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "util.h"
+
+typedef struct {
+	uint64_t h;
+	const char *s;             /* NULL for an empty slot */
+	size_t len, idx;
+} Entry;
+
+static Entry *table;
+static size_t tablesiz, used; /* tablesiz is a power of two */
+
+static uint64_t mix(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+/* wyhash style: one multiply per 8 bytes */
+unsigned long long dedup_hash(const char *s, size_t len)
+{
+	uint64_t h = 0xa0761d6478bd642fULL ^ len, w;
+
+	for (; len >= 8; s += 8, len -= 8) {
+		memcpy(&w, s, 8);
+		h = mix(h ^ w, 0xe7037ed1a0b428dbULL);
+	}
+	w = 0;
+	memcpy(&w, s, len);
+	return mix(h ^ w, 0x8ebc6af09c88c6e3ULL);
+}
+
+static Entry *slot(uint64_t h, const char *s, size_t len)
+{
+	size_t i, mask = tablesiz - 1;
+	Entry *e;
+
+	for (i = h & mask; ; i = (i + 1) & mask) {
+		e = &table[i];
+		if (!e->s || (e->h == h && e->len == len && !memcmp(e->s, s, len)))
+			return e;
+	}
+}
+
+long dedup_find(unsigned long long h, const char *s, size_t len)
+{
+	Entry *e;
+
+	if (!tablesiz)
+		return -1;
+	e = slot(h, s, len);
+	return e->s ? (long)e->idx : -1;
+}
+
+static void grow(void)
+{
+	Entry *old = table, *e;
+	size_t i, oldsiz = tablesiz;
+
+	tablesiz = tablesiz ? tablesiz * 2 : 4096;
+	table = (Entry *)ecalloc(tablesiz, sizeof(*table));
+	for (i = 0; i < oldsiz; i++)
+		if (old[i].s) {
+			e = slot(old[i].h, old[i].s, old[i].len);
+			*e = old[i];
+		}
+	free(old);
+}
+
+void dedup_add(unsigned long long h, const char *s, size_t len, size_t idx)
+{
+	Entry *e;
+
+	/* keep the load at most one half so probe sequences stay short */
+	if (2 * (used + 1) > tablesiz)
+		grow();
+	e = slot(h, s, len);
+	if (!e->s)
+		used++;
+	e->h = h;
+	e->s = s;
+	e->len = len;
+	e->idx = idx;
+}
+
+void dedup_clear(void)
+{
+	free(table);
+	table = NULL;
+	tablesiz = used = 0;
+}
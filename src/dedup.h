@@ -0,0 +1,10 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Set of strings for removing duplicates: an open addressing table of
+ * hashes and pointers to strings kept elsewhere, e.g. in the arena. */
+unsigned long long dedup_hash(const char *s, size_t len);
+/* index stored with a string equal to s, or -1 */
+long dedup_find(unsigned long long h, const char *s, size_t len);
+/* add s, which must stay valid, with index idx */
+void dedup_add(unsigned long long h, const char *s, size_t len, size_t idx);
+void dedup_clear(void);
@@ -4,15 +4,25 @@
 #include <string.h>
 #include <QScreen>
 #include <QWidget>
+#include <QWindow>
 #include <QRect>
 #include <QFont>
 #include <QColor>
+#include <QPen>
+#include <QBrush>
 #include <QPixmap>
 #include <QPainter>
-#include <QFontDatabase>
+#include <QFontInfo>
+#include <QFontMetrics>
+#include <QHash>
+#include <QCache>
+#include <QList>
+#include <QTextLayout>
+#include <QTextOption>
 #include <QDebug>
 
 #include "drw.h"
+#include "stats.h"
 #include "util.h"
 
 #define UTF_INVALID 0xFFFD
@@ -66,7 +76,9 @@ static size_t utf8decode(const char *c, long *u, size_t clen)
 
 Drw * drw_create(QScreen *screen, QScreen *root, unsigned int w, unsigned int h)
 {
-	QPixmap* pixmap= new QPixmap(w, h);
+	qreal dpr = screen->devicePixelRatio();
+	QPixmap* pixmap= new QPixmap(w * dpr, h * dpr);
+	pixmap->setDevicePixelRatio(dpr);
 	QPainter painter(pixmap);
 
 	// Set line attributes
@@ -112,8 +124,28 @@ void drw_resize(Drw *drw, unsigned int w, unsigned int h)
 	}
 }
 
+/* schedule a repaint of the window from the drawable */
+static void winupdate(Drw *drw)
+{
+	if (drw->win)
+		drw->win->update();
+	else if (drw->rwin)
+		drw->rwin->requestUpdate();
+}
+
+static void fontmap_clear(Drw *drw)
+{
+	if (drw->fontmap)
+		memset(drw->fontmap, 0, 0x10000);
+	if (drw->fontmapx)
+		drw->fontmapx->clear();
+}
+
 void drw_free(Drw *drw)
 {
+	delete drw->tiles;
+	delete drw->fontmapx;
+	free(drw->fontmap);
 	drw_fontset_free(drw->fonts);
 	free(drw);
 }
@@ -126,11 +158,19 @@ static Fnt * xfont_create(Drw *drw, const char *fontname, char *fontpattern)
 	Fnt *font;
 	QFont *xfont = NULL;
 	char *pattern = NULL;
+	const char *size;
 
 	if (fontname) {
-		xfont = new QFont(fontname);
-		if (!(QFontDatabase::families().contains(xfont->family()))) {
-			qDebug() << "Font familiy not available, using default " << xfont->family();
+		/* "family:size" or "family:size=size"; the family is only checked
+		 * against the font database once the font is drawn with */
+		if ((size = strchr(fontname, ':'))) {
+			xfont = new QFont(QString::fromUtf8(fontname, size - fontname));
+			if (!strncmp(++size, "size=", 5))
+				size += 5;
+			if (atof(size) > 0)
+				xfont->setPointSizeF(atof(size));
+		} else {
+			xfont = new QFont(fontname);
 		}
 	} else if (fontpattern) {
 		// not supported atm 
@@ -140,11 +180,11 @@ static Fnt * xfont_create(Drw *drw, const char *fontname, char *fontpattern)
 		die("no font specified.");
 	}
 
-	QFontMetrics metrics(*xfont);
 	font = (Fnt *)ecalloc(1, sizeof(Fnt));
 	font->xfont = xfont;
+	font->metrics = new QFontMetrics(*xfont);
 	font->pattern = pattern;
-	font->h = metrics.ascent() + metrics.descent();
+	font->h = font->metrics->ascent() + font->metrics->descent();
 
 	return font;
 }
@@ -153,9 +193,53 @@ static void xfont_free(Fnt *font)
 {
 	if (!font)
 		return;
+	delete font->metrics;
+	delete font->xfont;
 	free(font);
 }
 
+/* warn once if the font resolved to another family than the one asked for */
+static Fnt *xfont_check(Fnt *font)
+{
+	if (!font->checked) {
+		font->checked = 1;
+		QFontInfo info(*font->xfont);
+		if (info.family().compare(font->xfont->family(), Qt::CaseInsensitive))
+			qDebug() << "Font family" << font->xfont->family() << "not available, using" << info.family();
+	}
+	return font;
+}
+
+/* the first font of the set that has a glyph for codepoint u, or the first
+ * font if none has; Qt then falls back to a system font. The choice is
+ * cached per codepoint, so only the first lookup queries the fonts. */
+static Fnt *xfont_for(Drw *drw, long u)
+{
+	unsigned char *slot, i;
+	Fnt *f;
+
+	if (!drw->fonts->next || u < 0)
+		return drw->fonts;
+	if (u < 0x10000) {
+		if (!drw->fontmap)
+			drw->fontmap = (unsigned char *)ecalloc(0x10000, 1);
+		slot = &drw->fontmap[u];
+	} else {
+		if (!drw->fontmapx)
+			drw->fontmapx = new QHash<unsigned int, unsigned char>;
+		slot = &(*drw->fontmapx)[u];
+	}
+	if (!*slot) {
+		for (i = 1, f = drw->fonts; f && i < 255; f = f->next, i++)
+			if (xfont_check(f)->metrics->inFontUcs4(u))
+				break;
+		*slot = f && i < 255 ? i : 1;
+	}
+	for (i = *slot, f = drw->fonts; --i && f->next; f = f->next)
+		;
+	return f;
+}
+
 Fnt* drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount) 
 {
 	Fnt *cur, *ret = NULL;
@@ -170,6 +254,7 @@ Fnt* drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 			ret = cur;
 		}
 	}
+	fontmap_clear(drw);
 	return (drw->fonts = ret);
 }
 
@@ -181,41 +266,51 @@ void drw_fontset_free(Fnt *font)
 	}
 }
 
-void drw_clr_create(Drw *drw, QColor **dest, const char *clrname)
+/* (re)initialize dest in place, so a scheme can be switched without
+ * allocating */
+void drw_clr_create(Drw *drw, Clr *dest, const char *clrname)
 {
 	if (!drw || !dest || !clrname)
 		return;
-	*dest = new QColor(clrname);
+	dest->color = QColor(clrname);
+	if (!dest->color.isValid())
+		die("error, cannot allocate color '%s'", clrname);
+	dest->pen = QPen(dest->color);
+	dest->brush = QBrush(dest->color);
 }
 
-/* Wrapper to create color schemes. The caller has to call free(3) on the
- * returned color scheme when done using it. */
-QColor ** drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount)
+/* Wrapper to create color schemes. The caller has to call drw_scm_free on
+ * the returned color scheme when done using it. */
+Clr *drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount)
 {
 	size_t i;
-	QColor **retColors = (QColor **)ecalloc(clrcount, sizeof(QColor));
-	QColor *ret;
+	Clr *ret;
+
 	/* need at least two colors for a scheme */
 	if (!drw || !clrnames || clrcount < 2)
 		return NULL;
+	ret = new Clr[clrcount];
+	drw_tiles_clear(drw);
+	for (i = 0; i < clrcount; i++)
+		drw_clr_create(drw, &ret[i], clrnames[i]);
+	return ret;
+}
 
-	for (i = 0; i < clrcount; i++) {
-		ret = (QColor *)ecalloc(1, sizeof(QColor));
-		if (!ret)
-			return NULL;
-		drw_clr_create(drw, &ret, clrnames[i]);
-		retColors[i] = ret;
-	}
-	return retColors;
+void drw_scm_free(Clr *scm)
+{
+	delete[] scm;
 }
 
 void drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw)
+	if (drw) {
 		drw->fonts = set;
+		drw_tiles_clear(drw);
+		fontmap_clear(drw);
+	}
 }
 
-void drw_setscheme(Drw *drw, QColor **scm)
+void drw_setscheme(Drw *drw, Clr *scm)
 {
 	if (drw)
 		drw->scheme = scm;
@@ -227,34 +322,72 @@ void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled
 		return;
 
 	QPainter painter(drw->drawable);
-	QColor *fgColor = drw->scheme[ColBg];
-	QColor *bgColor = drw->scheme[ColFg];
+	const Clr *clr = &drw->scheme[invert ? ColBg : ColFg];
 
-	if(!invert) {
-		painter.setPen(*bgColor);
-		painter.setBrush(*bgColor);
-	} else {
-		painter.setPen(*fgColor);
-		painter.setBrush(*fgColor);
-	}
 	if(filled) {
-		painter.fillRect(x, y, w, h, painter.brush());  // Draw filled rectangle
+		painter.fillRect(x, y, w, h, clr->brush);  // Draw filled rectangle
 	} else {
+		painter.setPen(clr->pen);
 		painter.drawRect(x, y, w-1, h-1);  // Draw outlined rectangle
 	}
-	drw->win->update();
+	winupdate(drw);
 }
 
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
 {
-	int ty, ellipsis_x = 0;
-	unsigned int tmpw, ew, ellipsis_w = 0, ellipsis_len, hash, h0, h1;
-	Fnt *usedfont, *curfont, *nextfont;
-	int utf8strlen, utf8charlen, render = x || y || w || h;
+	return drw_textn(drw, x, y, w, h, lpad, text, text ? strlen(text) : 0, invert);
+}
+
+/* like drw_text, but text is not NUL terminated and spans len bytes */
+int drw_textn(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, size_t len, int invert)
+{
+	return drw_texthl(drw, x, y, w, h, lpad, text, len, NULL, 0, NULL, invert);
+}
+
+/* draw str[0..len) with the parts of hl inside it in color fg, all in one layout */
+static void drawhl(QPainter *painter, QFont *font, int x, int y, const char *start, const char *str, size_t len,
+                   const Span *hl, int nhl, const Clr *fg)
+{
+	QList<QTextLayout::FormatRange> formats;
+	QTextLayout::FormatRange r;
+	size_t off = str - start, a, b;
+	int i;
+
+	QString qttext = QString::fromUtf8(str, len);
+	for (i = 0; i < nhl; i++) {
+		a = MAX((size_t)hl[i].off, off);
+		b = MIN((size_t)hl[i].off + hl[i].len, off + len);
+		if (a >= b)
+			continue;
+		/* byte offsets to utf-16 offsets */
+		r.start = QString::fromUtf8(str, a - off).length();
+		r.length = QString::fromUtf8(start + a, b - a).length();
+		r.format.setForeground(fg->brush);
+		formats.append(r);
+	}
+	QTextLayout layout(qttext, *font, painter->device());
+	QTextOption option;
+	option.setWrapMode(QTextOption::NoWrap);
+	layout.setTextOption(option);
+	layout.setFormats(formats);
+	layout.beginLayout();
+	layout.createLine();
+	layout.endLayout();
+	layout.draw(painter, QPointF(x, y));
+}
+
+int drw_texthl(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, size_t len,
+               const Span *hl, int nhl, const Clr *hlfg, int invert)
+{
+	int ty, ellipsis_x;
+	unsigned int tmpw, ew, ellipsis_w;
+	Fnt *usedfont, *curfont;
+	size_t utf8strlen, utf8charlen, ellipsis_len;
+	int render = x || y || w || h;
 	long utf8codepoint = 0;
-	const char *utf8str;
-	int charexists = 0, overflow = 0;
-	static unsigned int nomatches[128], ellipsis_width;
+	const char *utf8str, *start = text, *end, *p;
+	int overflow = 0;
+	static unsigned int ellipsis_width;
 
 	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
 		return 0;
@@ -264,103 +397,157 @@ int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 	} else {
 		QPainter painter(drw->drawable);
 		/* inverse video colors for the text: its diffrent than x11 */
-		QColor *color = invert ? drw->scheme[ColFg] : drw->scheme[ColBg];
-		painter.setPen(*color);
-		painter.setBrush(*color);
-		painter.fillRect(x, y, w, h, painter.brush());
-		drw->win->update();
+		painter.fillRect(x, y, w, h, drw->scheme[invert ? ColFg : ColBg].brush);
+		winupdate(drw);
 		x += lpad;
 		w -= lpad;
 	}
 
-	usedfont = drw->fonts;
+	end = text + len;
 	if (!ellipsis_width && render)
 		ellipsis_width = drw_fontset_getwidth(drw, "...");
 
-	while (1) {
-		ew = ellipsis_len = utf8strlen = 0;
+	while (text < end) {
+		/* the run of characters drawn with the same font, measured at once */
+		usedfont = NULL;
+		for (p = text; p < end; p += utf8charlen) {
+			if (!(utf8charlen = utf8decode(p, &utf8codepoint, end - p)))
+				utf8charlen = end - p; /* truncated sequence */
+			curfont = xfont_for(drw, utf8codepoint);
+			if (usedfont && curfont != usedfont)
+				break;
+			usedfont = curfont;
+		}
 		utf8str = text;
-		nextfont = NULL;
-		while (*text) {
-			utf8charlen = QString::fromUtf8(text).length();
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = 1; //charexists || 1XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					drw_font_getexts(drw, curfont, text, utf8charlen, &tmpw, NULL);
-					if (ew + ellipsis_width <= w) {
-						// keep track where the ellipsis still fits
-						ellipsis_x = x + ew;
-						ellipsis_w = w - ew;
-						ellipsis_len = utf8strlen;
-					}
-
-					if (ew + tmpw > w) {
-						overflow = 1;
-						// called from drw_fontset_getwidth_clamp():
-						// it wants the width AFTER the overflow
-						//
-						if (!render)
-							x += tmpw;
-						else
-							utf8strlen = ellipsis_len;
-					} else if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-						ew += tmpw;
-					} else {
-						nextfont = curfont;
-					}
-					break;
+		utf8strlen = p - text;
+		tmpw = usedfont->metrics->horizontalAdvance(QString::fromUtf8(text, utf8strlen));
+
+		if (tmpw > w) {
+			overflow = 1;
+			if (!render) {
+				// called from drw_fontset_getwidth_clamp():
+				// it wants the width AFTER the overflow
+				x += tmpw;
+				break;
+			}
+			/* the run does not fit: find where the ellipsis still does */
+			ellipsis_x = x;
+			ellipsis_w = 0;
+			ellipsis_len = 0;
+			for (ew = 0, p = text; p < utf8str + utf8strlen; p += utf8charlen) {
+				utf8charlen = utf8decode(p, &utf8codepoint, utf8str + utf8strlen - p);
+				if (!utf8charlen)
+					utf8charlen = utf8str + utf8strlen - p;
+				if (ew + ellipsis_width <= w) {
+					// keep track where the ellipsis still fits
+					ellipsis_x = x + ew;
+					ellipsis_w = w - ew;
+					ellipsis_len = p - text;
 				}
+				ew += usedfont->metrics->horizontalAdvance(QString::fromUtf8(p, utf8charlen));
+				if (ew > w)
+					break;
 			}
-
-			if (overflow || !charexists || nextfont)
-				break;
-			else
-				charexists = 0;
+			utf8strlen = ellipsis_len;
+			tmpw = ellipsis_x - x;
 		}
 
-		if (utf8strlen) {
-			if (render) {
+		if (utf8strlen && render) {
+			xfont_check(usedfont);
+			ty = y + (h - usedfont->h) / 2 + usedfont->metrics->ascent();
 
-				QFontMetrics metrics(*usedfont->xfont);
-				ty = y + (h - usedfont->h) / 2 + metrics.ascent();
+			QPainter painter(drw->drawable);
+			painter.setPen(drw->scheme[invert ? ColBg : ColFg].pen);
+			painter.setFont(*usedfont->xfont);
 
-				QPainter painter(drw->drawable);
-				QColor *color = !invert ? drw->scheme[ColFg] : drw->scheme[ColBg];
-				painter.setPen(*color);  // Set the pen (outline) color to background color
-				painter.setBrush(*color);  // Set the brush (fill) color to background color
-				painter.setFont(*usedfont->xfont);
-				drw->win->update();
-
-				// Draw text
+			// Draw text
+			if (nhl) {
+				drawhl(&painter, usedfont->xfont, x, ty - usedfont->metrics->ascent(), start, utf8str, utf8strlen, hl, nhl, hlfg);
+			} else {
 				QString qttext = QString::fromUtf8(utf8str, utf8strlen);
 				painter.drawText(x, ty, qttext);
-				drw->win->update();
 			}
-			x += ew;
-			w -= ew;
+			winupdate(drw);
 		}
-		if (render && overflow)
-			drw_text(drw, ellipsis_x, y, ellipsis_w, h, 0, "...", invert);
+		x += tmpw;
+		w -= tmpw;
+		text += utf8strlen;
 
-		if (!*text || overflow) {
+		if (overflow) {
+			drw_text(drw, ellipsis_x, y, ellipsis_w, h, 0, "...", invert);
 			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
-		} else {
-			qDebug() << "fallback paint";
 		}
 	}
 	return x + (render ? w : 0);
 }
 
+void drw_tiles_create(Drw *drw, size_t maxkb)
+{
+	if (drw && !drw->tiles)
+		drw->tiles = new QCache<unsigned long long, QPixmap>(maxkb);
+}
+
+/* tiles depend on the fonts and colors, drop them when those change */
+void drw_tiles_clear(Drw *drw)
+{
+	if (drw && drw->tiles)
+		drw->tiles->clear();
+}
+
+int drw_tile_map(Drw *drw, unsigned long long key, int x, int y)
+{
+	QPixmap *tile;
+
+	if (!drw || !drw->tiles || drw->target)
+		return 0;
+	if (!(tile = drw->tiles->object(key))) {
+		stats_count(CntTileMiss, 1);
+		return 0;
+	}
+	stats_count(CntTileHit, 1);
+	QPainter painter(drw->drawable);
+	painter.drawPixmap(x, y, *tile);
+	winupdate(drw);
+	return 1;
+}
+
+void drw_tile_begin(Drw *drw, unsigned int w, unsigned int h)
+{
+	qreal dpr;
+
+	if (!drw || !drw->tiles || drw->target)
+		return;
+	/* render at device resolution so blitting does not scale */
+	dpr = drw->drawable->devicePixelRatio();
+	QPixmap *tile = new QPixmap(w * dpr, h * dpr);
+	tile->setDevicePixelRatio(dpr);
+	drw->target = drw->drawable;
+	drw->drawable = tile;
+}
+
+void drw_tile_end(Drw *drw, unsigned long long key, int x, int y)
+{
+	QPixmap *tile;
+
+	if (!drw || !drw->target)
+		return;
+	tile = drw->drawable;
+	drw->drawable = drw->target;
+	drw->target = NULL;
+	{
+		QPainter painter(drw->drawable);
+		painter.drawPixmap(x, y, *tile);
+	}
+	winupdate(drw);
+	/* cost in KiB; the cache owns the tile from here on and may drop it right away */
+	drw->tiles->insert(key, tile, (size_t)tile->width() * tile->height() * 4 / 1024 + 1);
+}
+
 void drw_map(Drw *drw, QWidget *win, int x, int y, unsigned int w, unsigned int h)
 {
 	if (!drw)
 		return;
-	drw->win->update();
+	winupdate(drw);
 }
 
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text)
@@ -371,10 +558,15 @@ unsigned int drw_fontset_getwidth(Drw *drw, const char *text)
 }
 
 unsigned int drw_fontset_getwidth_clamp(Drw *drw, const char *text, unsigned int n)
+{
+	return drw_fontset_getwidthn_clamp(drw, text, text ? strlen(text) : 0, n);
+}
+
+unsigned int drw_fontset_getwidthn_clamp(Drw *drw, const char *text, size_t len, unsigned int n)
 {
 	unsigned int tmp = 0;
 	if (drw && drw->fonts && text && n)
-		tmp = drw_text(drw, 0, 0, 0, 0, 0, text, n);
+		tmp = drw_textn(drw, 0, 0, 0, 0, 0, text, len, n);
 	return MIN(n, tmp);
 }
 
@@ -383,19 +575,10 @@ void drw_font_getexts(Drw *drw, Fnt *font, const char *text, unsigned int len, u
 	if (!font || !text)
 		return;
 
-	QPixmap dummy(1, 1);
-	QPainter painter(&dummy);
-	painter.setFont(*font->xfont);
-
-	// Get the bounding rectangle of the text
-	QRect rect = painter.boundingRect(QRect(), Qt::AlignLeft, text);
-
-	if (w) {
-		*w = rect.width(); // Width of the text
-	}
-	if (h) {
-		*h = rect.height(); // Height of the text
-	}
+	if (w)
+		*w = font->metrics->horizontalAdvance(QString::fromUtf8(text, len));
+	if (h)
+		*h = font->h;
 }
 
 /* 
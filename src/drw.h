@@ -10,11 +10,23 @@ typedef struct {
 typedef struct Fnt {
 	unsigned int h;
 	QFont *xfont;
+	QFontMetrics *metrics;
 	char * pattern;
+	int checked;                           /* resolved family was compared with the requested one */
 	struct Fnt *next;
 } Fnt;
 
 enum { ColFg, ColBg }; /* Clr scheme index */
+/* a scheme color with the pen and brush painting it, made once */
+typedef struct {
+	QColor color;
+	QPen pen;
+	QBrush brush;
+} Clr;
+
+typedef struct {
+	unsigned int off, len; /* byte range within a string */
+} Span;
 
 typedef struct {
 	unsigned int w, h;
@@ -22,8 +34,13 @@ typedef struct {
 	QScreen *root;
 	QPixmap *drawable;
 	Fnt *fonts;
-	QColor **scheme;
+	Clr *scheme;
 	QWidget *win;
+	QWindow *rwin;                         /* raster window, used instead of win */
+	QPixmap *target;                       /* drawable while rendering a tile */
+	QCache<unsigned long long, QPixmap> *tiles;
+	unsigned char *fontmap;                /* per BMP codepoint: 1 + index of the font drawing it, 0 if unknown */
+	QHash<unsigned int, unsigned char> *fontmapx; /* the same for codepoints above the BMP */
 } Drw;
 
 /* Drawable abstraction */
@@ -36,11 +53,13 @@ Fnt *drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
 void drw_fontset_free(Fnt* set);
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 unsigned int drw_fontset_getwidth_clamp(Drw *drw, const char *text, unsigned int n);
+unsigned int drw_fontset_getwidthn_clamp(Drw *drw, const char *text, size_t len, unsigned int n);
 void drw_font_getexts(Drw *drw, Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
 
 /* Colorscheme abstraction */
-void drw_clr_create(Drw *drw, QColor *dest, const char *clrname);
-QColor **drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount);
+void drw_clr_create(Drw *drw, Clr *dest, const char *clrname);
+Clr *drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount);
+void drw_scm_free(Clr *scm);
 
 /* Cursor abstraction
 Cur *drw_cur_create(Drw *drw, int shape);
@@ -49,11 +68,25 @@ void drw_cur_free(Drw *drw, Cur *cursor);
 
 /* Drawing context manipulation */
 void drw_setfontset(Drw *drw, Fnt *set);
-void drw_setscheme(Drw *drw, QColor **scm);
+void drw_setscheme(Drw *drw, Clr *scm);
 
 /* Drawing functions */
 void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert);
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert);
+int drw_textn(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, size_t len, int invert);
+/* like drw_textn, with the nhl byte ranges in hl drawn in color hlfg */
+int drw_texthl(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, size_t len,
+               const Span *hl, int nhl, const Clr *hlfg, int invert);
+
+/* Tile cache: pre-rendered rows, keyed by the caller.
+ * drw_tile_map blits a cached tile and returns 1, or returns 0 if there is none.
+ * Drawing between drw_tile_begin and drw_tile_end goes to a new tile at 0,0
+ * which is then cached and blitted to x,y. */
+void drw_tiles_create(Drw *drw, size_t maxkb);
+void drw_tiles_clear(Drw *drw);
+int drw_tile_map(Drw *drw, unsigned long long key, int x, int y);
+void drw_tile_begin(Drw *drw, unsigned int w, unsigned int h);
+void drw_tile_end(Drw *drw, unsigned long long key, int x, int y);
 
 /* Map functions */
 void drw_map(Drw *drw, QWidget *win, int x, int y, unsigned int w, unsigned int h);
@@ -0,0 +1,216 @@
+/* See LICENSE file for copyright and license details. */
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "path.h"
+#include "pool.h"
+#include "util.h"
+
+typedef struct {
+	char *path;
+	struct timespec mtime;
+	int stale;                 /* not in the cache, or changed since */
+	char *names;               /* NUL terminated names of the executables */
+	size_t len, siz;
+} Dir;
+
+static Dir *dirs;
+static size_t ndirs;
+static char *pathcopy;         /* copy of $PATH the directory paths point into */
+
+static void addname(Dir *d, const char *s, size_t len)
+{
+	if (d->len + len + 1 > d->siz) {
+		d->siz = MAX(d->siz * 2, d->len + len + 1 + 4096);
+		d->names = (char *)erealloc(d->names, d->siz);
+	}
+	memcpy(d->names + d->len, s, len);
+	d->names[d->len + len] = '\0';
+	d->len += len + 1;
+}
+
+/* the absolute directories of $PATH that exist, each once; relative ones
+ * depend on the working directory, which the cache does not record */
+static void getdirs(void)
+{
+	const char *env = getenv("PATH");
+	char *p, *dir;
+	struct stat st;
+	size_t i;
+
+	if (!(pathcopy = strdup(env ? env : "/usr/local/bin:/usr/bin:/bin")))
+		die("strdup:");
+	dirs = (Dir *)ecalloc(strlen(pathcopy) / 2 + 1, sizeof(*dirs));
+	for (p = pathcopy; (dir = strsep(&p, ":"));) {
+		if (*dir != '/' || stat(dir, &st) || !S_ISDIR(st.st_mode))
+			continue;
+		for (i = 0; i < ndirs && strcmp(dirs[i].path, dir); i++)
+			;
+		if (i < ndirs)
+			continue;
+		dirs[ndirs].path = dir;
+		dirs[ndirs].mtime = st.st_mtim;
+		dirs[ndirs].stale = 1;
+		ndirs++;
+	}
+}
+
+static const char *cachepath(void)
+{
+	static char path[PATH_MAX];
+	const char *dir = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+
+	if (dir && *dir)
+		snprintf(path, sizeof path, "%s/qdmenu_path", dir);
+	else if (home && *home)
+		snprintf(path, sizeof path, "%s/.cache/qdmenu_path", home);
+	else
+		return NULL;
+	return path;
+}
+
+/* The cache has a line "directory<TAB>seconds nanoseconds" per directory,
+ * followed by the names found in it, one per line. A directory line is
+ * told apart from a name by its leading slash. */
+static void loadcache(const char *path)
+{
+	FILE *fp;
+	Dir *cur = NULL;
+	char *line = NULL, *tab;
+	size_t linesiz = 0, i;
+	ssize_t len;
+	long long sec;
+	long nsec;
+
+	if (!path || !(fp = fopen(path, "r")))
+		return;
+	while ((len = getline(&line, &linesiz, fp)) != -1) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (line[0] != '/') {
+			if (cur && len)
+				addname(cur, line, len);
+			continue;
+		}
+		cur = NULL;
+		if (!(tab = strrchr(line, '\t')) || sscanf(tab + 1, "%lld %ld", &sec, &nsec) != 2)
+			continue;
+		*tab = '\0';
+		for (i = 0; i < ndirs; i++) {
+			if (!dirs[i].stale || strcmp(dirs[i].path, line))
+				continue;
+			if (dirs[i].mtime.tv_sec == sec && dirs[i].mtime.tv_nsec == nsec) {
+				dirs[i].stale = 0;
+				cur = &dirs[i];
+			}
+			break;
+		}
+	}
+	free(line);
+	fclose(fp);
+}
+
+static void savecache(const char *path)
+{
+	char tmp[PATH_MAX], *dir;
+	const char *s, *end;
+	FILE *fp;
+	size_t i;
+
+	if (!path || snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid()) >= (int)sizeof tmp)
+		return;
+	/* the cache directory may not exist yet */
+	if ((dir = strrchr(tmp, '/')) && dir != tmp) {
+		*dir = '\0';
+		mkdir(tmp, 0755);
+		*dir = '/';
+	}
+	if (!(fp = fopen(tmp, "w")))
+		return;
+	for (i = 0; i < ndirs; i++) {
+		fprintf(fp, "%s\t%lld %ld\n", dirs[i].path,
+		        (long long)dirs[i].mtime.tv_sec, (long)dirs[i].mtime.tv_nsec);
+		for (s = dirs[i].names, end = s + dirs[i].len; s < end; s += strlen(s) + 1)
+			fprintf(fp, "%s\n", s);
+	}
+	if (fclose(fp) || rename(tmp, path))
+		unlink(tmp);
+}
+
+/* read the stale directories idx[lo..hi) */
+static void readdirs(size_t lo, size_t hi, void *arg)
+{
+	const size_t *idx = (const size_t *)arg;
+	struct dirent *ent;
+	struct stat st;
+	DIR *dp;
+	Dir *d;
+	int fd;
+
+	for (; lo < hi; lo++) {
+		d = &dirs[idx[lo]];
+		if (!(dp = opendir(d->path)))
+			continue;
+		fd = dirfd(dp);
+		/* regular files and links to them that we may execute, as stest -flx */
+		while ((ent = readdir(dp))) {
+			if (ent->d_name[0] == '.' || strchr(ent->d_name, '\n'))
+				continue;
+			if (ent->d_type != DT_REG && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN)
+				continue;
+			if (fstatat(fd, ent->d_name, &st, 0) || !S_ISREG(st.st_mode) ||
+			    faccessat(fd, ent->d_name, X_OK, 0))
+				continue;
+			addname(d, ent->d_name, strlen(ent->d_name));
+		}
+		closedir(dp);
+	}
+}
+
+void path_items(void (*add)(const char *name, size_t len))
+{
+	const char *cache = cachepath(), **names, *s, *end;
+	size_t *stale, nstale = 0, nnames = 0, i, j;
+
+	getdirs();
+	loadcache(cache);
+
+	stale = (size_t *)ecalloc(ndirs + 1, sizeof(*stale));
+	for (i = 0; i < ndirs; i++)
+		if (dirs[i].stale)
+			stale[nstale++] = i;
+	if (nstale) {
+		pool_for(nstale, 1, readdirs, stale);
+		savecache(cache);
+	}
+	free(stale);
+
+	for (i = 0; i < ndirs; i++)
+		for (s = dirs[i].names, end = s + dirs[i].len; s < end; s += strlen(s) + 1)
+			nnames++;
+	names = (const char **)ecalloc(nnames + 1, sizeof(*names));
+	for (i = 0, j = 0; i < ndirs; i++)
+		for (s = dirs[i].names, end = s + dirs[i].len; s < end; s += strlen(s) + 1)
+			names[j++] = s;
+	std::sort(names, names + nnames, [](const char *a, const char *b) {
+		return strcmp(a, b) < 0;
+	});
+	for (i = 0; i < nnames; i++)
+		if (!i || strcmp(names[i], names[i - 1]))
+			add(names[i], strlen(names[i]));
+
+	free(names);
+	for (i = 0; i < ndirs; i++)
+		free(dirs[i].names);
+	free(dirs);
+	free(pathcopy);
+	dirs = NULL;
+	ndirs = 0;
+}
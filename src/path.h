@@ -0,0 +1,8 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Executables in $PATH, like dmenu_path: the names of the regular,
+ * executable files of all $PATH directories, sorted and without
+ * duplicates. The names of each directory are kept in a cache file and
+ * only read again when the modification time of the directory changed;
+ * stale directories are read in parallel. add is called once per name. */
+void path_items(void (*add)(const char *name, size_t len));
@@ -0,0 +1,87 @@
+/* See LICENSE file for copyright and license details. */
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "pool.h"
+#include "util.h"
+
+/* never destroyed, the workers may still wait on them at exit */
+static std::mutex *mtx;
+static std::condition_variable *wake, *done;
+static unsigned int nworkers;
+static unsigned long jobgen;
+static unsigned int busy;
+static struct {
+	void (*fn)(size_t lo, size_t hi, void *arg);
+	void *arg;
+	size_t n, grain;
+	std::atomic<size_t> next;
+} job;
+
+static void work(void)
+{
+	size_t lo;
+
+	while ((lo = job.next.fetch_add(job.grain)) < job.n)
+		job.fn(lo, MIN(lo + job.grain, job.n), job.arg);
+}
+
+static void worker(void)
+{
+	unsigned long seen = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(*mtx);
+			wake->wait(lock, [&seen] { return jobgen != seen; });
+			seen = jobgen;
+		}
+		work();
+		std::lock_guard<std::mutex> lock(*mtx);
+		if (--busy == 0)
+			done->notify_one();
+	}
+}
+
+unsigned int pool_threads(void)
+{
+	unsigned int n = std::thread::hardware_concurrency();
+
+	return n ? n : 1;
+}
+
+void pool_for(size_t n, size_t grain, void (*fn)(size_t lo, size_t hi, void *arg), void *arg)
+{
+	unsigned int i;
+
+	grain = MAX(grain, (size_t)1);
+	if (n <= grain || pool_threads() < 2) {
+		fn(0, n, arg);
+		return;
+	}
+	if (!mtx) {
+		mtx = new std::mutex();
+		wake = new std::condition_variable();
+		done = new std::condition_variable();
+		nworkers = pool_threads() - 1; /* the caller works too */
+		for (i = 0; i < nworkers; i++)
+			std::thread(worker).detach();
+	}
+	{
+		std::lock_guard<std::mutex> lock(*mtx);
+		job.fn = fn;
+		job.arg = arg;
+		job.n = n;
+		job.grain = grain;
+		job.next = 0;
+		busy = nworkers;
+		jobgen++;
+	}
+	wake->notify_all();
+	work();
+	std::unique_lock<std::mutex> lock(*mtx);
+	done->wait(lock, [] { return busy == 0; });
+}
@@ -0,0 +1,8 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Fixed pool of worker threads for data parallel loops. pool_for calls
+ * fn(lo, hi, arg) for consecutive ranges of at most grain indices covering
+ * [0, n), on the workers and the calling thread, and returns when all are
+ * done. Small loops run on the calling thread only. */
+void pool_for(size_t n, size_t grain, void (*fn)(size_t lo, size_t hi, void *arg), void *arg);
+unsigned int pool_threads(void);
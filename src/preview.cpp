@@ -0,0 +1,167 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <QCoreApplication>
+#include <QByteArray>
+#include <QCache>
+#include <QProcess>
+#include <QStringList>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+
+#include "preview.h"
+#include "stats.h"
+
+#define PREVIEW_MAX (64 * 1024) /* bytes of output kept per preview */
+
+static const char *command;
+static void (*notify)(unsigned long key);
+static QThreadPool *pool;
+static QCache<unsigned long, QByteArray> *cache;
+static QTimer *timer;
+static std::atomic<unsigned long> generation;
+static unsigned long pendingkey;
+static QByteArray pendingarg;
+
+static QByteArray readhead(const QByteArray &path)
+{
+	QByteArray out;
+	FILE *fp;
+	size_t n;
+
+	if (!(fp = fopen(path.constData(), "r")))
+		return out;
+	out.resize(PREVIEW_MAX);
+	n = fread(out.data(), 1, PREVIEW_MAX, fp);
+	out.resize(n);
+	fclose(fp);
+	return out;
+}
+
+/* run the preview command, giving up as soon as a newer request arrives */
+static QByteArray runcommand(const QByteArray &arg, unsigned long gen)
+{
+	QProcess proc;
+	QByteArray out;
+
+	proc.start("/bin/sh", QStringList() << "-c" << command << "sh" << QString::fromUtf8(arg));
+	if (!proc.waitForStarted())
+		return out;
+	proc.closeWriteChannel();
+	while (out.size() < PREVIEW_MAX) {
+		if (generation != gen) {
+			out.clear();
+			break;
+		}
+		if (proc.waitForReadyRead(20))
+			out += proc.readAllStandardOutput();
+		else if (proc.state() == QProcess::NotRunning)
+			break;
+	}
+	out += proc.readAllStandardOutput();
+	if (proc.state() != QProcess::NotRunning) {
+		proc.kill();
+		proc.waitForFinished();
+	}
+	out.truncate(PREVIEW_MAX);
+	return out;
+}
+
+class PreviewJob : public QRunnable {
+public:
+	PreviewJob(unsigned long key, const QByteArray &arg, unsigned long gen)
+		: key(key), arg(arg), gen(gen)
+	{}
+
+	void run() override {
+		QByteArray out;
+
+		if (generation != gen)
+			return;
+		out = command ? runcommand(arg, gen) : readhead(arg);
+		if (generation != gen)
+			return;
+		unsigned long k = key, g = gen;
+		QMetaObject::invokeMethod(QCoreApplication::instance(), [k, g, out]() {
+			if (generation != g)
+				return;
+			cache->insert(k, new QByteArray(out), out.size() / 1024 + 1);
+			notify(k);
+		}, Qt::QueuedConnection);
+	}
+
+private:
+	unsigned long key;
+	QByteArray arg;
+	unsigned long gen;
+};
+
+static void start(void)
+{
+	if (cache->contains(pendingkey))
+		notify(pendingkey);
+	else
+		pool->start(new PreviewJob(pendingkey, pendingarg, generation));
+}
+
+void preview_init(const char *cmd, size_t cachekb, int delay, void (*done)(unsigned long key))
+{
+	command = cmd;
+	notify = done;
+	pool = new QThreadPool();
+	pool->setMaxThreadCount(2);
+	cache = new QCache<unsigned long, QByteArray>(cachekb);
+	timer = new QTimer();
+	timer->setSingleShot(true);
+	timer->setInterval(delay);
+	QObject::connect(timer, &QTimer::timeout, start);
+}
+
+void preview_request(unsigned long key, const char *arg, size_t len)
+{
+	if (!pool)
+		return;
+	generation++; /* cancels queued and running jobs */
+	pendingkey = key;
+	pendingarg = QByteArray(arg, len);
+	/* cached previews need no debouncing */
+	if (cache->contains(key)) {
+		stats_count(CntPreviewHit, 1);
+		timer->stop();
+		notify(key);
+	} else {
+		stats_count(CntPreviewMiss, 1);
+		timer->start();
+	}
+}
+
+const QByteArray *preview_get(unsigned long key)
+{
+	return cache ? cache->object(key) : NULL;
+}
+
+void preview_clear(void)
+{
+	if (!cache)
+		return;
+	generation++;
+	cache->clear();
+}
+
+void preview_free(void)
+{
+	if (!pool)
+		return;
+	generation++;
+	pool->clear();
+	pool->waitForDone();
+	delete timer;
+	delete cache;
+	delete pool;
+	timer = NULL;
+	cache = NULL;
+	pool = NULL;
+}
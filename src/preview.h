@@ -0,0 +1,14 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Asynchronous item previews. The preview of an item is the output of cmd,
+ * run by sh(1) with the item as $1, or the head of the file named by the
+ * item if cmd is NULL. Requests are debounced by delay milliseconds, run on
+ * a small thread pool, cancelled by the next request and kept in an LRU cache
+ * of at most cachekb KiB. done is called on the gui thread once the preview
+ * of key is available from preview_get. */
+void preview_init(const char *cmd, size_t cachekb, int delay, void (*done)(unsigned long key));
+void preview_request(unsigned long key, const char *arg, size_t len);
+const QByteArray *preview_get(unsigned long key);
+void preview_clear(void);
+/* wait for the running jobs and free the pool and cache */
+void preview_free(void);
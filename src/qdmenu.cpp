@@ -1,42 +1,116 @@
 /* See LICENSE file for copyright and license details. */
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <locale.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <algorithm>
 
 #include <QApplication>
 #include <QScreen>
 #include <QWidget>
 #include <QColor>
+#include <QPalette>
 #include <QWindow>
+#include <QBackingStore>
 #include <QPainter>
 #include <QKeyEvent>
 #include <QDebug>
 #include <QClipboard>
 #include <QMimeData>
 #include <QLineEdit>
-
+#include <QSocketNotifier>
+#include <QCache>
+#include <QFontMetrics>
+#include <QHash>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QEventLoop>
+
+#include "arena.h"
+#include "dedup.h"
 #include "drw.h"
+#include "path.h"
+#include "pool.h"
+#include "preview.h"
+#include "shm.h"
+#include "stats.h"
 #include "util.h"
 
 /* macros */
 #define INTERSECT(x,y,w,h,r)  (MAX(0, MIN((x)+(w),(r).x_org+(r).width)  - MAX((x),(r).x_org)) \
                              * MAX(0, MIN((y)+(h),(r).y_org+(r).height) - MAX((y),(r).y_org)))
 #define TEXTW(X)              (drw_fontset_getwidth(drw, (X)) + lrpad)
+#define HLMAX                 8    /* highlighted tokens per item */
+#define HLCACHE               256  /* items with cached highlights, more than a page */
+#define PARALLELMIN           16384 /* items below which scans stay on one thread */
+#define PARALLELGRAIN         4096  /* items per parallel work unit */
+#define INDEXMIN              16384 /* items below which no prefix index is built */
+#define SCANSTEP              65536 /* items scanned per step of the deferred scan */
+#define REPLAYROUNDS          20    /* times the -T key sequence is replayed */
+#define READBLOCK             (1 << 20) /* initial size of the stdin read buffer */
+#define INGESTMIN             (16 << 20) /* input files from which on records are parsed in parallel */
+#define INGESTWINDOW          ((size_t)64 << 20) /* bytes of records parsed in parallel at a time */
+#define SPECMIN               16384 /* items below which no query is matched ahead of time */
+#define SPECKEYS              4     /* likely next keys matched ahead of time */
+#define SPECSAMPLE            4096  /* matches sampled to guess the next key */
+#define SPECSTEP              16384 /* matches tried per step of the speculation */
+#define STRATINDEXNS          50000 /* guessed ns of an index lookup */
+#define STRATPOOLNS           20000 /* guessed ns to start and join a parallel scan */
+#define STOREVERSION          1     /* layout of the shared item store, bump on changes */
 
 /* enums */
-enum { SchemeNorm, SchemeSel, SchemeOut, SchemeLast }; /* color schemes */
+enum { SchemeNorm, SchemeSel, SchemeOut,
+       SchemeNormHighlight, SchemeSelHighlight, SchemeLast }; /* color schemes */
+enum { MatchExact, MatchPrefix, MatchSubstr, MatchLast }; /* match result buckets */
+enum { StratScan, StratParallel, StratIndex, StratLast }; /* match strategies, as CntStrat* */
 
 struct item {
 	char *text;
 	struct item *left, *right;
-	int out;
+	unsigned int count;   /* occurrences in the input with -u or -U */
+	unsigned int nfields; /* number of field spans, 0 if no field delimiter is set */
+	size_t field;         /* index of the first field span in spans[] */
+	unsigned long long sig; /* character classes present in text, see sigbit() */
 };
 
+/* a record of a chunk of input, found by one of the parallel parsers */
+typedef struct {
+	const char *s;
+	size_t len;
+	unsigned long long h; /* dedup hash with -u */
+	unsigned long long sig;
+	size_t field;         /* index of the first field span in the chunk's spans */
+	unsigned int nfields;
+	unsigned int count;   /* occurrences with -u */
+	int dup;              /* duplicate of an earlier record with -u */
+} Rec;
+
+typedef struct {
+	const char *lo, *hi;  /* input of the chunk, whole records */
+	Rec *recs;
+	size_t nrecs, recsiz;
+	Span *spans;
+	size_t nspans, spansiz;
+	/* the records that are not duplicates and where their items go */
+	size_t nkept, nkeptspans, textsize;
+	size_t item, span;    /* index of the first item and field span */
+	char *text;           /* arena space for the texts */
+	size_t itembytes, sigfreq[64];
+} Chunk;
+
 static char text[BUFSIZ] = "";
 static char *embed;
 static int bh, mw, mh;
@@ -46,7 +120,78 @@ static size_t cursor;
 static struct item *items = NULL;
 static struct item *matches, *matchend;
 static struct item *prev, *curr, *next, *sel;
+static struct item *bucketend[MatchLast]; /* last item of each bucket in matches */
+static size_t nitems, itemsiz, nmatches;
+static unsigned long long *marks;         /* bitset of the marked items, by index */
+static size_t markwords, nmarked;
+/* a tokenized query; the tokens point into buf */
+struct query {
+	char text[BUFSIZ];
+	char buf[BUFSIZ];
+	char **tokv;
+	size_t *tokl, textlen;
+	int *tokord;                      /* token indices, the rarest first */
+	double *toksel;                   /* estimated fraction of items having each token */
+	int tokc, tokn;
+	int spaced;                       /* text is not its tokens joined by single spaces */
+	unsigned long long sig;           /* character classes all tokens need */
+};
+
+static struct query q;                    /* tokens of the input text */
+static size_t sigfreq[64];                /* items having each character class */
+static unsigned long querygen;            /* bumped whenever the tokens or items change */
+static int regex;                         /* -r option; input is a regular expression */
+static int widgets;                       /* -W option; QWidget window instead of a raster window */
+static int pathitems;                     /* -x option; items are the executables in $PATH */
+static char recsep = '\n';                /* -z and -R options; record separator of input and output */
+static QRegularExpression *re;            /* compiled input, NULL if invalid */
+static char relit[BUFSIZ];                /* literal every match of re contains */
+static size_t relitlen;
+static size_t *sorted, nindexed;          /* first nindexed items, sorted by match key */
+static size_t *cand, ncand, candsiz;      /* items found through the index, in input order */
+static signed char *bucket;               /* bucket of each item, for the parallel scan */
+static size_t bucketsiz;
+static size_t restpos, restcand;          /* progress of the deferred scan of the other items */
+static int pending;                       /* the deferred scan is not finished */
+static int strategy = -1;                 /* -st option; match strategy to use when possible, -1 to plan */
+static const char *stratnames[StratLast] = { "scan", "parallel", "index" };
+static double stratcost[2][StratLast];    /* measured ns per item of the scans, per query of the index,
+                                           * for plain and regular expression queries */
+static int stratruns[2][StratLast];       /* measurements in stratcost */
+static size_t itembytes;                  /* text bytes of all items */
+static QTimer *frametimer;                /* matches the edits made within a frame */
+/* matches of the queries one key ahead, keyed by query text; each entry is
+ * a sorted array of (bucket << 62 | item index) */
+static QCache<QByteArray, QByteArray> *speccache;
+static struct query specq;                /* query being matched ahead of time */
+static struct item *specitem;             /* next match of the current query to try */
+static unsigned long long *specres;       /* matches of specq found so far */
+static size_t nspecres, specressiz;
+static char speckeys[SPECKEYS];           /* keys still to speculate on */
+static int nspeckeys;
+static unsigned long specgen;             /* bumped to cancel the speculation */
+static QElapsedTimer lastmatch;           /* time since an edit was last matched */
+static int framems;                       /* frame interval of the screen */
+static int editpending;                   /* text was edited but not matched yet */
+static double replay50, replay99;         /* -T option; key latency limits in ms, 0 if off */
+static int replayerrors;                  /* replayed keys after which nothing was selected */
 static int mon = -1;
+static const char *livefile;       /* -L option; input file to watch for changes */
+static const char *previewcmd;     /* -P option; preview command, NULL to preview files */
+static int preview;                /* -P or -Pf given */
+static int pvw;                    /* width of the preview pane */
+static struct item *pvsel;         /* item the preview was requested for */
+static size_t membudget;           /* -M option; bytes of item text kept on the heap */
+static int unique;                 /* -u option, 2 for -U to also rank by count */
+static char delim;                 /* -d option; field delimiter, 0 if unset */
+static int *matchfields;           /* -n option; 1-based fields to match on */
+static int nmatchfields;
+static int dispfield, outfield;    /* -D and -O options; 0 is the whole line */
+static Span *spans;                /* fields of all items, as ranges of item->text */
+static size_t nspans, spansiz;
+static int shared;                 /* -H option; share the parsed items between instances */
+static unsigned long long storekey; /* key to publish the items under, 0 if not */
+static int stored;                 /* the items are mapped from another instance */
 static QScreen *screen, *root, *parentwin, *win;
 
 /* 
@@ -56,16 +201,19 @@ static XIC xic;
 */
 
 static Drw *drw;
-static QColor **scheme[SchemeLast];
+static Clr *scheme[SchemeLast];
+static QPalette palette[SchemeLast];     /* the schemes for widgets */
 
 #include "config.h"
 
 static int (*fstrncmp)(const char *, const char *, size_t) = strncmp;
-static char *(*fstrstr)(const char *, const char *) = strstr;
+static const char *(*fstrstr)(const char *, const char *) = strstr;
+static void *(*fmemmem)(const void *, size_t, const void *, size_t) = memmem;
 
 // forwared declarations
 static void keypress(QKeyEvent *ev);
 static void cleanup(void);
+static void settheme(const char *clrs[][2]);
 
 // edit window
 class DMenuLineEdit : public QLineEdit {
@@ -76,8 +224,12 @@ public:
         : QLineEdit(parent)
     {}
 
+	/* the cursor was at the end before the last key moved it */
+	int wasatend = 0;
+
 protected:
     void keyPressEvent(QKeyEvent* event) override {
+	wasatend = cursorPosition() == text().length();
         // Call base class implementation for unhandled key presses
         QLineEdit::keyPressEvent(event);
 	keypress(event);
@@ -94,10 +246,14 @@ private:
 protected:
 
     void paintEvent(QPaintEvent* event) override {
-		QPainter painter(this);
-		if (drw->drawable) {
-			painter.drawPixmap(0, 0, *drw->drawable);
+		unsigned long long t = stats_begin();
+		{
+			QPainter painter(this);
+			if (drw->drawable) {
+				painter.drawPixmap(0, 0, *drw->drawable);
+			}
 		}
+		stats_end(StatPaint, t);
     }
 
     void keyPressEvent(QKeyEvent* event) override {
@@ -134,10 +290,17 @@ public:
     }
 
 	void updateEditBox(int ex, int ey, int ew, int eh) {
-		lineEdit->setStyleSheet(QString("QLineEdit { border: none; background-color: %1; color: %2; }").arg(drw->scheme[ColBg]->name()).arg(drw->scheme[ColFg]->name()));
 		lineEdit->setGeometry(ex, ey, ew, eh);
 	}
 
+	/* colors of the window and the line edit, set when the theme changes */
+	void setTheme(const QPalette &pal) {
+		setPalette(pal);
+		setAutoFillBackground(true);
+		lineEdit->setPalette(pal);
+		lineEdit->setFrame(false);
+	}
+
 	void focusEditBox() {
 		lineEdit->setFocus();
 	}
@@ -150,6 +313,16 @@ public:
 		return lineEdit;
 	}
 
+	/* show text changed by keypress itself, e.g. by Tab or Ctrl+W */
+	void setText(const char *s, size_t cursor) {
+		QString t = QString::fromUtf8(s);
+
+		if (t != lineEdit->text()) {
+			lineEdit->setText(t);
+			lineEdit->setCursorPosition(QString::fromUtf8(s, cursor).length());
+		}
+	}
+
 public slots:
 
 	void onTextChanged(const QString& newText) {
@@ -157,28 +330,160 @@ public slots:
 	}
 };
 
+/* main window without widgets or style sheets: the input field is drawn
+ * by drawmenu and edited by keypress, the drawable is copied to the
+ * window through a backing store */
+class DMenuRasterWindow : public QWindow {
+private:
+	QBackingStore *store;
+
+protected:
+	bool event(QEvent *event) override {
+		if (event->type() == QEvent::UpdateRequest) {
+			paint();
+			return true;
+		}
+		return QWindow::event(event);
+	}
+
+	void exposeEvent(QExposeEvent *event) override {
+		paint();
+	}
+
+	void resizeEvent(QResizeEvent *event) override {
+		store->resize(size());
+	}
+
+	void keyPressEvent(QKeyEvent *event) override {
+		keypress(event);
+	}
+
+public:
+	DMenuRasterWindow(QWindow *parent = nullptr) : QWindow(parent) {
+		setFlags(Qt::FramelessWindowHint);
+		store = new QBackingStore(this);
+	}
+
+	/* copy the drawable to the screen now */
+	void paint() {
+		unsigned long long t = stats_begin();
+		QRect rect(0, 0, width(), height());
+
+		if (!isExposed() || !drw->drawable)
+			return;
+		store->beginPaint(rect);
+		{
+			QPainter painter(store->paintDevice());
+			painter.drawPixmap(0, 0, *drw->drawable);
+		}
+		store->endPaint();
+		store->flush(rect);
+		stats_end(StatPaint, t);
+	}
+};
+
 
-static unsigned int textw_clamp(const char *str, unsigned int n)
+static unsigned int textw_clamp(const char *str, size_t len, unsigned int n)
 {
-	unsigned int w = drw_fontset_getwidth_clamp(drw, str, n) + lrpad;
+	unsigned int w = drw_fontset_getwidthn_clamp(drw, str, len, n) + lrpad;
 	return MIN(w, n);
 }
 
+/* return field n (1-based) of item; n == 0 or no delimiter selects the whole line */
+static const char *itemfield(const struct item *item, int n, size_t *len)
+{
+	const Span *sp;
+
+	if (!delim || n <= 0) {
+		*len = strlen(item->text);
+		return item->text;
+	}
+	if ((unsigned int)n > item->nfields) {
+		*len = 0;
+		return "";
+	}
+	sp = &spans[item->field + n - 1];
+	*len = sp->len;
+	return item->text + sp->off;
+}
+
+/* append the fields of text to the span array *v of *n used and *siz
+ * allocated entries, and return how many there are */
+static unsigned int fieldspans(const char *text, size_t len, Span **v, size_t *n, size_t *siz)
+{
+	const char *s, *p, *end = text + len;
+	size_t first = *n;
+
+	for (s = text; ; s = p + 1) {
+		if (*n >= *siz) {
+			*siz = *siz ? *siz * 2 : 1024;
+			*v = (Span *)erealloc(*v, *siz * sizeof(**v));
+		}
+		/* memchr is vectorized in the common libcs, no need for hand written SIMD */
+		p = (const char *)memchr(s, delim, end - s);
+		(*v)[*n].off = s - text;
+		(*v)[*n].len = (p ? p : end) - s;
+		(*n)++;
+		if (!p)
+			break;
+	}
+	return *n - first;
+}
+
+static void splitfields(struct item *item, size_t len)
+{
+	item->field = nspans;
+	item->nfields = fieldspans(item->text, len, &spans, &nspans, &spansiz);
+}
 
-static void appenditem(struct item *item, struct item **list, struct item **last)
+/* rank item against the input text; exact and prefix are relative to the first match field */
+static int matchrank(const struct item *item, const struct query *qp)
 {
-	if (*last)
-		(*last)->right = item;
-	else
-		*list = item;
+	const char *key, *tok = qp->tokv[0];
+	size_t keylen, toklen = qp->tokl[0];
+
+	if (!delim || !nmatchfields) {
+		if (!fstrncmp(qp->text, item->text, qp->textlen + 1))
+			return MatchExact;
+		return fstrncmp(tok, item->text, toklen) ? MatchSubstr : MatchPrefix;
+	}
+	key = itemfield(item, matchfields[0], &keylen);
+	if (keylen == qp->textlen && !fstrncmp(qp->text, key, qp->textlen))
+		return MatchExact;
+	if (keylen >= toklen && !fstrncmp(tok, key, toklen))
+		return MatchPrefix;
+	return MatchSubstr;
+}
 
-	item->left = *last;
-	item->right = NULL;
-	*last = item;
+/* return non-zero if tok occurs in any of the fields selected for matching */
+static int matchtoken(const struct item *item, const char *tok, size_t toklen)
+{
+	const char *s;
+	size_t len;
+	int i;
+
+	if (!delim || !nmatchfields)
+		return fstrstr(item->text, tok) != NULL;
+	for (i = 0; i < nmatchfields; i++) {
+		s = itemfield(item, matchfields[i], &len);
+		if (fmemmem(s, len, tok, toklen))
+			return 1;
+	}
+	return 0;
+}
+
+
+static unsigned int itemw_clamp(const struct item *item, unsigned int n)
+{
+	size_t len;
+	const char *s = itemfield(item, dispfield, &len);
+
+	return textw_clamp(s, len, n);
 }
 
 static void calcoffsets(void)
 {
+	unsigned long long t = stats_begin();
 	int i, n;
 
 	if (lines > 0)
@@ -187,11 +492,20 @@ static void calcoffsets(void)
 		n = mw - (promptw + inputw + TEXTW("<") + TEXTW(">"));
 	/* calculate which items will begin the next page and previous page */
 	for (i = 0, next = curr; next; next = next->right)
-		if ((i += (lines > 0) ? bh : textw_clamp(next->text, n)) > n)
+		if ((i += (lines > 0) ? bh : itemw_clamp(next, n)) > n)
 			break;
 	for (i = 0, prev = curr; prev && prev->left; prev = prev->left)
-		if ((i += (lines > 0) ? bh : textw_clamp(prev->left->text, n)) > n)
+		if ((i += (lines > 0) ? bh : itemw_clamp(prev->left, n)) > n)
 			break;
+	stats_end(StatCalcoffsets, t);
+}
+
+static void freequery(struct query *qp)
+{
+	free(qp->tokv);
+	free(qp->tokl);
+	free(qp->tokord);
+	free(qp->toksel);
 }
 
 static void cleanup(void) 
@@ -199,45 +513,198 @@ static void cleanup(void)
 	size_t i;
 
 	for (i = 0; i < SchemeLast; i++)
-		free(scheme[i]);
-	for (i = 0; items && items[i].text; ++i)
-		free(items[i].text);
+		drw_scm_free(scheme[i]);
+	arena_free();
+	dedup_clear();
 	free(items);
+	free(spans);
+	free(sorted);
+	free(cand);
+	free(bucket);
+	free(marks);
+	free(matchfields);
+	freequery(&q);
+	freequery(&specq);
+	free(specres);
+	delete speccache;
+	delete re;
+	preview_free();
 	drw_free(drw);
+	shm_detach();
 }
 
-static char * cistrstr(const char *h, const char *n)
+static const char * cistrstr(const char *h, const char *n)
 {
 	size_t i;
 
 	if (!n[0])
-		return (char *)h;
+		return h;
 
 	for (; *h; ++h) {
 		for (i = 0; n[i] && tolower((unsigned char)n[i]) ==
 		            tolower((unsigned char)h[i]); ++i)
 			;
 		if (n[i] == '\0')
-			return (char *)h;
+			return h;
+	}
+	return NULL;
+}
+
+static void * cimemmem(const void *hv, size_t hlen, const void *nv, size_t nlen)
+{
+	const char *h = (const char *)hv, *n = (const char *)nv;
+	size_t i, j;
+
+	if (!nlen)
+		return (void *)h;
+
+	for (i = 0; i + nlen <= hlen; i++) {
+		for (j = 0; j < nlen && tolower((unsigned char)n[j]) ==
+		            tolower((unsigned char)h[i + j]); ++j)
+			;
+		if (j == nlen)
+			return (void *)(h + i);
 	}
 	return NULL;
 }
 
+/* return the ranges of the displayed text s of item that matched the tokens.
+ * They are only computed for items that get drawn, once per query. */
+static int highlights(const struct item *item, const char *s, size_t len, const Span **hl)
+{
+	static struct {
+		size_t idx;
+		unsigned long gen;
+		int n;
+		Span hl[HLMAX];
+	} cache[HLCACHE];
+	size_t idx = item - items;
+	const char *p;
+	int c, i, n;
+
+	c = idx % HLCACHE;
+	*hl = cache[c].hl;
+	if (cache[c].idx == idx && cache[c].gen == querygen)
+		return cache[c].n;
+	if (re) {
+		QString str = QString::fromUtf8(s, len);
+		QRegularExpressionMatch m = re->match(str);
+
+		n = 0;
+		if (m.hasMatch() && m.capturedLength()) {
+			/* utf-16 offsets to byte offsets */
+			cache[c].hl[0].off = str.left(m.capturedStart()).toUtf8().size();
+			cache[c].hl[0].len = str.mid(m.capturedStart(), m.capturedLength()).toUtf8().size();
+			n = 1;
+		}
+		cache[c].idx = idx;
+		cache[c].gen = querygen;
+		return cache[c].n = n;
+	}
+	/* tokens may be missing from the displayed field if other fields are matched */
+	for (i = n = 0; i < q.tokc && n < HLMAX; i++) {
+		if (!(p = (const char *)fmemmem(s, len, q.tokv[i], q.tokl[i])))
+			continue;
+		cache[c].hl[n].off = p - s;
+		cache[c].hl[n++].len = q.tokl[i];
+	}
+	cache[c].idx = idx;
+	cache[c].gen = querygen;
+	return cache[c].n = n;
+}
+
+static int drawtext(struct item *item, int x, int y, int w, int scm)
+{
+	size_t len;
+	const char *s = itemfield(item, dispfield, &len);
+	const Span *hl;
+	int nhl = q.tokc || re ? highlights(item, s, len, &hl) : 0;
+
+	return drw_texthl(drw, x, y, w, bh, lrpad / 2, s, len, hl, nhl,
+	                  &scheme[scm == SchemeSel ? SchemeSelHighlight : SchemeNormHighlight][ColFg], 0);
+}
+
+static int ismarked(const struct item *item)
+{
+	size_t i = item - items;
+
+	return i / 64 < markwords && (marks[i / 64] >> (i % 64) & 1);
+}
+
+static void mark(const struct item *item, int on)
+{
+	size_t i = item - items, w = i / 64, n;
+	unsigned long long bit = 1ULL << (i % 64);
+
+	if (w >= markwords) {
+		if (!on)
+			return;
+		n = MAX(markwords * 2, w + 1);
+		marks = (unsigned long long *)erealloc(marks, n * sizeof(*marks));
+		memset(marks + markwords, 0, (n - markwords) * sizeof(*marks));
+		markwords = n;
+	}
+	if (!(marks[w] & bit) != !on)
+		return;
+	marks[w] ^= bit;
+	nmarked += on ? 1 : -1;
+}
+
 static int drawitem(struct item *item, int x, int y, int w)
 {
-	if (item == sel)
-		drw_setscheme(drw, scheme[SchemeSel]);
-	else if (item->out)
-		drw_setscheme(drw, scheme[SchemeOut]);
-	else
-		drw_setscheme(drw, scheme[SchemeNorm]);
-	return drw_text(drw, x, y, w, bh, lrpad / 2, item->text, 0);
+	unsigned long long key;
+	int scm, r;
+
+	scm = item == sel ? SchemeSel : ismarked(item) ? SchemeOut : SchemeNorm;
+	drw_setscheme(drw, scheme[scm]);
+	if (lines > 0 && drw->tiles) {
+		/* rows of the vertical list are cached, keyed by item, scheme and width */
+		key = (unsigned long long)(item - items) << 20 | scm << 16 | (w & 0xffff);
+		if (drw_tile_map(drw, key, x, y))
+			return x + w;
+		drw_tile_begin(drw, w, bh);
+		r = drawtext(item, 0, 0, w, scm);
+		drw_tile_end(drw, key, x, y);
+		return x + r;
+	}
+	return drawtext(item, x, y, w, scm);
+}
+
+static void drawpreview(void)
+{
+	const QByteArray *pv;
+	const char *s, *e, *end;
+	int x = mw - pvw, y;
+
+	drw_setscheme(drw, scheme[SchemeNorm]);
+	drw_rect(drw, x, bh, pvw, mh - bh, 1, 1);
+	if (!sel || !(pv = preview_get(sel - items)))
+		return;
+	s = pv->constData();
+	end = s + pv->size();
+	for (y = bh; s < end && y < mh; y += bh, s = e + 1) {
+		if (!(e = (const char *)memchr(s, '\n', end - s)))
+			e = end;
+		drw_textn(drw, x, y, pvw, bh, lrpad / 2, s, e - s, 0);
+	}
+}
+
+/* called when the preview of item index key is ready */
+static void previewdone(unsigned long key)
+{
+	if (!sel || key != (unsigned long)(sel - items))
+		return;
+	drawpreview();
+	drw_map(drw, drw->win, mw - pvw, bh, pvw, mh - bh);
 }
 
 static void drawmenu(void)
 {
+	unsigned long long t = stats_begin();
 	unsigned int curpos;
 	struct item *item;
+	const char *s;
+	size_t len;
 	int x = 0, y = 0, w;
 
 	drw_setscheme(drw, scheme[SchemeNorm]);
@@ -248,9 +715,14 @@ static void drawmenu(void)
 		x = drw_text(drw, x, 0, promptw, bh, lrpad / 2, prompt, 0);
 	}
 
-	// draw input field - moved to the main win class
+	// draw input field - a line edit of the main win class with -W
 	w = (lines > 0 || !matches) ? mw - x : inputw;
-	((DMenuWindow *)drw->win)->updateEditBox(x, 0, w, bh);
+	if (drw->win) {
+		((DMenuWindow *)drw->win)->updateEditBox(x, 0, w, bh);
+	} else {
+		drw_setscheme(drw, scheme[SchemeNorm]);
+		drw_text(drw, x, 0, w, bh, lrpad / 2, text, 0);
+	}
 
 	curpos = TEXTW(text) - TEXTW(&text[cursor]);
 	if ((curpos += lrpad / 2 - 1) < w) {
@@ -259,9 +731,16 @@ static void drawmenu(void)
 	}
 
 	if (lines > 0) {
-		// draw vertical list
+		// draw vertical list, next to the preview pane if there is one
 		for (item = curr; item != next; item = item->right)
-			drawitem(item, x, y += bh, mw - x);
+			drawitem(item, x, y += bh, mw - x - pvw);
+		if (pvw) {
+			if (sel != pvsel && (pvsel = sel)) {
+				s = itemfield(sel, outfield, &len);
+				preview_request(sel - items, s, len);
+			}
+			drawpreview();
+		}
 	} else if (matches) {
 		// draw horizontal list
 		x += inputw;
@@ -272,7 +751,7 @@ static void drawmenu(void)
 		}
 		x += w;
 		for (item = curr; item != next; item = item->right)
-			x = drawitem(item, x, 0, textw_clamp(item->text, mw - x - TEXTW(">")));
+			x = drawitem(item, x, 0, itemw_clamp(item, mw - x - TEXTW(">")));
 		if (next) {
 			w = TEXTW(">");
 			drw_setscheme(drw, scheme[SchemeNorm]);
@@ -280,6 +759,7 @@ static void drawmenu(void)
 		}
 	}
 	drw_map(drw, drw->win, 0, 0, mw, mh);
+	stats_end(StatDrawmenu, t);
 }
 
 
@@ -291,64 +771,815 @@ static void grabkeyboard(void)
 {
 }
 
-
-static void match(void)
+
+/* the last character of the escape whose letter or digit is at p */
+static const char *skipescape(const char *p)
+{
+	const char *end;
+
+	switch (*p) {
+	case 'Q': /* quoted up to \E */
+		return (end = strstr(p, "\\E")) ? end + 1 : p + strlen(p) - 1;
+	case 'c': /* control character */
+		return p[1] ? p + 1 : p;
+	case 'x': case 'o': case 'N': case 'p': case 'P': case 'g': case 'k':
+		/* braced or bracketed operand */
+		if (p[1] == '{' || p[1] == '<' || p[1] == '\'') {
+			end = strchr(p + 2, p[1] == '{' ? '}' : p[1] == '<' ? '>' : '\'');
+			return end ? end : p + strlen(p) - 1;
+		}
+		if (*p == 'x')
+			for (end = p; end < p + 2 && isxdigit((unsigned char)end[1]); end++)
+				;
+		else if (*p == 'g')
+			for (end = p + (p[1] == '-'); isdigit((unsigned char)end[1]); end++)
+				;
+		else if ((*p == 'p' || *p == 'P') && p[1])
+			end = p + 1;
+		else
+			end = p;
+		return end;
+	default:
+		/* octal codes and back references */
+		for (end = p; isdigit((unsigned char)*p) && isdigit((unsigned char)end[1]); end++)
+			;
+		return end;
+	}
+}
+
+/* the longest run of literal characters that every match of the regular
+ * expression p has to contain, for prefiltering; 0 if there is none. With
+ * -i the prefilter folds only ASCII, so non-ASCII bytes and k and s, which
+ * the expression also matches as the Kelvin sign and long s, end a run. */
+static size_t reliteral(const char *p, char *lit)
+{
+	char run[sizeof text];
+	const char *q;
+	size_t n = 0, best = 0;
+	int depth = 0, ci = fstrstr == cistrstr;
+	unsigned char c;
+
+	/* inline options such as (?i) change how the rest matches */
+	if (strstr(p, "(?"))
+		return 0;
+#define COMMIT() do { if (n > best) memcpy(lit, run, best = n); n = 0; } while (0)
+	for (; *p; p++) {
+		switch (*p) {
+		case '\\':
+			if (!*++p)
+				break;
+			/* classes, anchors, back references and character codes end
+			 * a run together with their operand, escaped punctuation is literal */
+			if (isalnum((unsigned char)*p)) {
+				COMMIT();
+				p = skipescape(p);
+				continue;
+			}
+			if (!depth)
+				run[n++] = *p;
+			continue;
+		case '[':
+			COMMIT();
+			/* skip the class, a ] right after [ or [^ is part of it */
+			for (q = p += (p[1] == '^') + 1; *p && (*p != ']' || p == q); p++)
+				if (*p == '\\' && p[1])
+					p++;
+			if (!*p)
+				p--;
+			continue;
+		case '(':
+			COMMIT();
+			depth++;
+			continue;
+		case ')':
+			COMMIT();
+			depth--;
+			continue;
+		case '|':
+			if (!depth) /* alternatives at the top level have nothing in common */
+				return 0;
+			continue;
+		case '*': case '?': case '{':
+			/* the preceding character, all of its UTF-8 bytes, is optional */
+			while (n && (run[n - 1] & 0xc0) == 0x80)
+				n--;
+			if (n)
+				n--;
+			COMMIT();
+			if (*p == '{')
+				while (p[1] && *p != '}')
+					p++;
+			continue;
+		case '+':
+		case '.': case '^': case '$':
+			COMMIT();
+			continue;
+		default:
+			c = *p;
+			if (ci && (c >= 0x80 || tolower(c) == 'k' || tolower(c) == 's'))
+				COMMIT();
+			else if (!depth)
+				run[n++] = *p;
+			continue;
+		}
+		break;
+	}
+	COMMIT();
+#undef COMMIT
+	return best;
+}
+
+/* compile the input text as regular expression; on an invalid (e.g. still
+ * incomplete) pattern re stays NULL and the plain matcher is used */
+static void compilere(void)
+{
+	delete re;
+	re = NULL;
+	relitlen = 0;
+	if (!*text)
+		return;
+	re = new QRegularExpression(QString::fromUtf8(text), fstrstr == cistrstr ?
+	                            QRegularExpression::CaseInsensitiveOption :
+	                            QRegularExpression::NoPatternOption);
+	if (!re->isValid()) {
+		delete re;
+		re = NULL;
+		return;
+	}
+	re->optimize(); /* jit compile now instead of on the first item */
+	relitlen = reliteral(text, relit);
+}
+
+/* return the bucket item belongs to for the regular expression, -1 if it does not match */
+static int matchre(const struct item *item)
+{
+	const char *s;
+	size_t len;
+	int i, n = delim && nmatchfields ? nmatchfields : 1;
+
+	for (i = 0; i < n; i++) {
+		s = itemfield(item, delim && nmatchfields ? matchfields[i] : 0, &len);
+		if (relitlen && !fmemmem(s, len, relit, relitlen))
+			continue;
+		QString str = QString::fromUtf8(s, len);
+		QRegularExpressionMatch m = re->match(str);
+		if (!m.hasMatch())
+			continue;
+		if (m.capturedStart())
+			return MatchSubstr;
+		return m.capturedLength() == str.length() ? MatchExact : MatchPrefix;
+	}
+	return -1;
+}
+
+/* signature bit of byte c: one per letter, case folded for -i, and
+ * digit, the other ASCII shares 27 and all other bytes one */
+static inline unsigned int sigbit(unsigned char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a';
+	if (c >= '0' && c <= '9')
+		return 26 + c - '0';
+	if (c >= 0x80)
+		return 63;
+	return 36 + c % 27;
+}
+
+/* the set of signature bits of the bytes of s; an item can only contain
+ * a token whose bits are all in its own */
+static unsigned long long textsig(const char *s, size_t len)
+{
+	unsigned long long sig = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sig |= 1ULL << sigbit(s[i]);
+	return sig;
+}
+
+/* estimated fraction of the items containing a token of signature sig,
+ * taking its character classes as independent */
+static double selectivity(unsigned long long sig)
+{
+	double f = 1.0;
+
+	for (; sig; sig &= sig - 1)
+		f *= (double)sigfreq[__builtin_ctzll(sig)] / nitems;
+	return f;
+}
+
+/* split str into the tokens of qp */
+static void parsequery(struct query *qp, const char *str)
+{
+	unsigned long long sig;
+	char *s;
+	size_t len;
+	int i;
+
+	snprintf(qp->text, sizeof qp->text, "%s", str);
+	strcpy(qp->buf, qp->text);
+	qp->tokc = 0;
+	for (s = strtok(qp->buf, " "); s; qp->tokv[qp->tokc - 1] = s, s = strtok(NULL, " "))
+		if (++qp->tokc > qp->tokn) {
+			qp->tokv = (char **)erealloc(qp->tokv, ++qp->tokn * sizeof *qp->tokv);
+			qp->tokl = (size_t *)erealloc(qp->tokl, qp->tokn * sizeof *qp->tokl);
+			qp->tokord = (int *)erealloc(qp->tokord, qp->tokn * sizeof *qp->tokord);
+			qp->toksel = (double *)erealloc(qp->toksel, qp->tokn * sizeof *qp->toksel);
+		}
+	qp->sig = 0;
+	for (i = 0; i < qp->tokc; i++) {
+		qp->tokl[i] = strlen(qp->tokv[i]);
+		sig = textsig(qp->tokv[i], qp->tokl[i]);
+		qp->sig |= sig;
+		qp->toksel[i] = nitems ? selectivity(sig) : 1.0;
+		qp->tokord[i] = i;
+	}
+	/* check the tokens least likely to occur first, so most items fail early */
+	std::stable_sort(qp->tokord, qp->tokord + qp->tokc, [qp](int a, int b) {
+		return qp->toksel[a] < qp->toksel[b] ||
+		       (qp->toksel[a] == qp->toksel[b] && qp->tokl[a] > qp->tokl[b]);
+	});
+	qp->textlen = strlen(qp->text);
+	for (i = 0, len = 0; i < qp->tokc; i++)
+		len += qp->tokl[i] + (i > 0);
+	qp->spaced = len != qp->textlen;
+}
+
+/* separate input text into tokens to be matched individually */
+static void tokenize(void)
+{
+	parsequery(&q, text);
+	querygen++;
+	/* cached rows carry the highlights of the previous query */
+	drw_tiles_clear(drw);
+	if (regex)
+		compilere();
+}
+
+/* return the bucket of item for the tokens of qp, or -1 if it does not match */
+static int matchquery(const struct item *item, const struct query *qp)
+{
+	int i;
+
+	/* an item lacking a character class of the tokens cannot match */
+	if ((item->sig & qp->sig) != qp->sig)
+		return -1;
+	for (i = 0; i < qp->tokc; i++)
+		if (!matchtoken(item, qp->tokv[qp->tokord[i]], qp->tokl[qp->tokord[i]]))
+			return -1; /* not all tokens match */
+	return qp->tokc ? matchrank(item, qp) : MatchExact;
+}
+
+static int matchitem(const struct item *item)
+{
+	if (re)
+		return matchre(item);
+	return matchquery(item, &q);
+}
+
+/* link item at the end of its bucket in the match list */
+static void insertmatch(struct item *item, int bucket)
+{
+	struct item *after = NULL;
+	int i;
+
+	/* the closest non-empty bucket at or before this one precedes the item */
+	for (i = bucket; i >= 0 && !(after = bucketend[i]); i--)
+		;
+	item->left = after;
+	item->right = after ? after->right : matches;
+	if (item->right)
+		item->right->left = item;
+	else
+		matchend = item;
+	if (after)
+		after->right = item;
+	else
+		matches = item;
+	bucketend[bucket] = item;
+	nmatches++;
+}
+
+static QByteArray speckey(const char *s)
+{
+	QByteArray key(s);
+
+	return fstrstr == cistrstr ? key.toLower() : key;
+}
+
+static void speccancel(void)
+{
+	specgen++;
+	nspeckeys = 0;
+}
+
+/* guess the keys typed next from the bytes following the last token in the
+ * current matches, or starting them if a new token begins */
+static int guesskeys(char *keys)
+{
+	size_t count[256] = { 0 }, n, len = strlen(text);
+	const char *tok = NULL, *p;
+	struct item *item;
+	int c, i, j, nkeys = 0;
+
+	if (len && text[len - 1] != ' ')
+		tok = q.tokv[q.tokc - 1];
+	for (item = matches, n = 0; item && n < SPECSAMPLE; item = item->right, n++) {
+		if (!tok)
+			c = (unsigned char)item->text[0];
+		else if ((p = fstrstr(item->text, tok)))
+			c = (unsigned char)p[q.tokl[q.tokc - 1]];
+		else
+			continue; /* the token is in a field not shown */
+		count[fstrstr == cistrstr ? tolower(c) : c]++;
+	}
+	for (i = 0; i < SPECKEYS; i++) {
+		for (c = 0, j = '!'; j <= '~'; j++)
+			if (count[j] && (!c || count[j] > count[c]))
+				c = j;
+		if (!c)
+			break;
+		count[c] = 0;
+		/* a key already matched ahead of time need not be again */
+		if (len + 1 < sizeof text && !speccache->contains(speckey(text) + (char)c))
+			keys[nkeys++] = c;
+	}
+	return nkeys;
+}
+
+static void specbegin(void)
+{
+	char buf[sizeof text + 1];
+
+	snprintf(buf, sizeof buf, "%s%c", text, speckeys[--nspeckeys]);
+	parsequery(&specq, buf);
+	specitem = matches;
+	nspecres = 0;
+}
+
+/* match the current matches against specq a slice at a time, so the event
+ * loop stays responsive, and cache the result once they are all tried */
+static void specstep(unsigned long gen)
+{
+	size_t n;
+	int b;
+
+	if (gen != specgen)
+		return;
+	for (n = 0; specitem && n < SPECSTEP; specitem = specitem->right, n++) {
+		if ((b = matchquery(specitem, &specq)) < 0)
+			continue;
+		if (nspecres == specressiz) {
+			specressiz = MAX(specressiz * 2, 4096);
+			specres = (unsigned long long *)erealloc(specres, specressiz * sizeof *specres);
+		}
+		specres[nspecres++] = (unsigned long long)b << 62 | (size_t)(specitem - items);
+	}
+	if (!specitem) {
+		/* by bucket, and in input order within each, as a full scan links them */
+		std::sort(specres, specres + nspecres);
+		speccache->insert(speckey(specq.text),
+		                  new QByteArray((const char *)specres, nspecres * sizeof *specres),
+		                  nspecres * sizeof *specres / 1024 + 1);
+		if (!nspeckeys)
+			return;
+		specbegin();
+	}
+	QTimer::singleShot(0, [gen]() { specstep(gen); });
+}
+
+/* Once the matches of the text are complete, match the likely next queries
+ * while the user is idle. Every item matching text+c matches text, so only
+ * the current matches are tried. Any edit cancels it. */
+static void specstart(void)
+{
+	unsigned long gen;
+
+	speccancel();
+	if (re || !speccache || nitems < SPECMIN || pending || editpending)
+		return;
+	if (!(nspeckeys = guesskeys(speckeys)))
+		return;
+	gen = specgen;
+	specbegin();
+	QTimer::singleShot(0, [gen]() { specstep(gen); });
+}
+
+/* link the matches of text from the speculation, if it got that far */
+static int matchspec(void)
+{
+	const QByteArray *res;
+	const unsigned long long *v;
+	size_t i, n;
+
+	if (!speccache || re)
+		return 0;
+	if (!(res = speccache->object(speckey(text)))) {
+		stats_count(CntSpecMiss, 1);
+		return 0;
+	}
+	v = (const unsigned long long *)res->constData();
+	n = res->size() / sizeof *v;
+	for (i = 0; i < n; i++)
+		insertmatch(&items[v[i] & ~(3ULL << 62)], v[i] >> 62);
+	stats_count(CntSpecHit, 1);
+	return 1;
+}
+
+/* the text exact and prefix matches are ranked against */
+static const char *matchkey(const struct item *item, size_t *len)
+{
+	return itemfield(item, delim && nmatchfields ? matchfields[0] : 0, len);
+}
+
+/* compare the first n bytes, case folded with -i like fstrncmp */
+static int keycmp(const char *a, const char *b, size_t n)
+{
+	size_t i;
+	int d;
+
+	if (fstrncmp == strncmp)
+		return memcmp(a, b, n);
+	for (i = 0; i < n; i++)
+		if ((d = tolower((unsigned char)a[i]) - tolower((unsigned char)b[i])))
+			return d;
+	return 0;
+}
+
+typedef struct {
+	const char *s;
+	size_t len, idx;
+} Key;
+
+static bool keyless(const Key &a, const Key &b)
+{
+	int d = keycmp(a.s, b.s, MIN(a.len, b.len));
+
+	return d ? d < 0 : a.len < b.len;
+}
+
+/* the keys, sorted in runs of width keys on the worker pool */
+typedef struct {
+	Key *keys;
+	size_t n, width;
+	int merge;            /* merge the halves of each run instead of sorting it */
+} KeySort;
+
+static void sortruns(size_t lo, size_t hi, void *arg)
+{
+	KeySort *ks = (KeySort *)arg;
+	Key *a, *b, *k;
+
+	for (; lo < hi; lo++) {
+		a = ks->keys + MIN(lo * ks->width, ks->n);
+		b = ks->keys + MIN((lo + 1) * ks->width, ks->n);
+		if (ks->merge) {
+			std::inplace_merge(a, MIN(a + ks->width / 2, b), b, keyless);
+			continue;
+		}
+		for (k = a; k < b; k++) {
+			k->idx = k - ks->keys;
+			k->s = matchkey(&items[k->idx], &k->len);
+		}
+		std::sort(a, b, keyless);
+	}
+}
+
+/* sort the items by their match key, so the items starting with a prefix
+ * form a range that can be found by binary search */
+static void buildindex(void)
+{
+	KeySort ks;
+	Key *keys;
+	size_t i, nruns = pool_threads();
+
+	nindexed = 0;
+	if (nitems < INDEXMIN)
+		return;
+	keys = (Key *)ecalloc(nitems, sizeof(*keys));
+	/* a run per thread, then merge them pairwise */
+	ks.keys = keys;
+	ks.n = nitems;
+	ks.width = (nitems + nruns - 1) / nruns;
+	ks.merge = 0;
+	pool_for(nruns, 1, sortruns, &ks);
+	for (ks.merge = 1; ks.width < nitems; ) {
+		ks.width *= 2;
+		pool_for((nitems + ks.width - 1) / ks.width, 1, sortruns, &ks);
+	}
+	sorted = (size_t *)erealloc(sorted, nitems * sizeof(*sorted));
+	for (i = 0; i < nitems; i++)
+		sorted[i] = keys[i].idx;
+	free(keys);
+	nindexed = nitems;
+}
+
+/* compare the match key of item idx with prefix p: 0 if the key starts with it */
+static int prefixcmp(size_t idx, const char *p, size_t plen)
+{
+	const char *key;
+	size_t len;
+	int d;
+
+	key = matchkey(&items[idx], &len);
+	if ((d = keycmp(key, p, MIN(len, plen))))
+		return d;
+	return len < plen ? -1 : 0;
+}
+
+/* exact and prefix matches all start with the first token: look them up in
+ * the index. The remaining items are left to scanrest(). */
+static void matchindex(void)
+{
+	size_t *lo, *hi;
+
+	lo = std::lower_bound(sorted, sorted + nindexed, 0, [](size_t idx, int) {
+		return prefixcmp(idx, q.tokv[0], q.tokl[0]) < 0;
+	});
+	hi = std::upper_bound(lo, sorted + nindexed, 0, [](int, size_t idx) {
+		return prefixcmp(idx, q.tokv[0], q.tokl[0]) > 0;
+	});
+	ncand = hi - lo;
+	if (ncand > candsiz) {
+		candsiz = ncand;
+		cand = (size_t *)erealloc(cand, candsiz * sizeof(*cand));
+	}
+	memcpy(cand, lo, ncand * sizeof(*cand));
+	std::sort(cand, cand + ncand);
+	for (size_t i = 0; i < ncand; i++) {
+		int b = matchitem(&items[cand[i]]);
+		if (b >= 0)
+			insertmatch(&items[cand[i]], b);
+	}
+	restpos = restcand = 0;
+	pending = 1;
+}
+
+/* with -M, have the kernel read the spilled texts ahead of a scan; [*lo, *hi)
+ * is the arena chunk of the last item, NULL at first */
+static void readahead(const struct item *item, const char **lo, const char **hi)
+{
+	if (membudget && (item->text < *lo || item->text >= *hi))
+		arena_readahead(item->text, lo, hi);
+}
+
+/* match the items the index did not yield, up to index end */
+static void scanrest(size_t end)
+{
+	const char *lo = NULL, *hi = NULL;
+	int b;
+
+	for (; restpos < end; restpos++) {
+		if (restcand < ncand && cand[restcand] == restpos) {
+			restcand++;
+			continue;
+		}
+		readahead(&items[restpos], &lo, &hi);
+		if ((b = matchitem(&items[restpos])) >= 0)
+			insertmatch(&items[restpos], b);
+	}
+	if (restpos >= nitems)
+		pending = 0;
+}
+
+/* finish the deferred scan, for whatever needs the complete match list */
+static void matchflush(void)
+{
+	if (!pending)
+		return;
+	scanrest(nitems);
+	/* the index may have found nothing to select */
+	if (!curr)
+		curr = sel = matches;
+	calcoffsets();
+}
+
+/* continue the deferred scan from the event loop in steps, so input is not
+ * held up by it; a new query makes the remaining steps no-ops */
+static void schedulescan(void)
+{
+	unsigned long gen = querygen;
+
+	QTimer::singleShot(0, [gen]() {
+		if (gen != querygen || !pending)
+			return;
+		scanrest(MIN(restpos + SCANSTEP, nitems));
+		if (pending)
+			schedulescan();
+		else
+			specstart();
+		/* the page only changes if it was not full yet */
+		if (!pending || !next) {
+			if (!curr)
+				curr = sel = matches;
+			calcoffsets();
+			drawmenu();
+		}
+	});
+}
+
+static void matchrange(size_t lo, size_t hi, void *arg)
+{
+	signed char *bucket = (signed char *)arg;
+	const char *tlo = NULL, *thi = NULL;
+
+	for (; lo < hi; lo++) {
+		readahead(&items[lo], &tlo, &thi);
+		bucket[lo] = matchitem(&items[lo]);
+	}
+}
+
+/* estimated ns to match the current query with strategy s. Until a strategy
+ * is measured its cost per item is guessed from the mean item length; the
+ * index costs a lookup per query, the rest is found after the first frame. */
+static double stratestimate(int s)
+{
+	int r = re != NULL;
+	double mean = nitems ? (double)itembytes / nitems : 0, peritem;
+
+	if (s == StratIndex)
+		return stratruns[r][s] ? stratcost[r][s] : STRATINDEXNS;
+	if (stratruns[r][s])
+		peritem = stratcost[r][s];
+	else if (s == StratParallel)
+		peritem = stratestimate(StratScan) / MAX(nitems, 1) / pool_threads();
+	else
+		peritem = r ? 50 + 5 * mean : 5 + mean / 4;
+	return peritem * nitems + (s == StratParallel ? STRATPOOLNS : 0);
+}
+
+/* pick the strategy expected to match the current query fastest */
+static int plan(void)
+{
+	int usable[StratLast], s, best = StratScan, r = re != NULL;
+	double cost[StratLast];
+
+	usable[StratScan] = 1;
+	usable[StratParallel] = nitems > PARALLELMIN && pool_threads() > 1;
+	/* exact and prefix matches are ranked by the whole text, which the
+	 * first token only finds if it is not led or padded by extra spaces */
+	usable[StratIndex] = !re && q.tokc && !q.spaced && nindexed && drw && (drw->win || drw->rwin);
+	if (strategy >= 0 && usable[strategy])
+		return strategy;
+	for (s = 0; s < StratLast; s++)
+		cost[s] = usable[s] ? stratestimate(s) : 0;
+	for (s = 0; s < StratLast; s++)
+		if (usable[s] && cost[s] < cost[best])
+			best = s;
+	/* measure the strategies not tried yet unless they are far off */
+	for (s = 0; s < StratLast; s++)
+		if (usable[s] && !stratruns[r][s] && cost[s] < 4 * cost[best])
+			return s;
+	return best;
+}
+
+/* fold the time strategy s took into its cost */
+static void calibrate(int s, unsigned long long ns)
+{
+	int r = re != NULL;
+	double v;
+
+	if (!nitems)
+		return;
+	if (s == StratIndex)
+		v = ns;
+	else if (s == StratParallel)
+		v = (double)(ns > STRATPOOLNS ? ns - STRATPOOLNS : 0) / nitems;
+	else
+		v = (double)ns / nitems;
+	stratcost[r][s] = stratruns[r][s]++ ? (3 * stratcost[r][s] + v) / 4 : v;
+}
+
+static void match(void)
+{
+	unsigned long long t = stats_begin();
+	QElapsedTimer timer;
+	struct item *item;
+	const char *lo = NULL, *hi = NULL;
+	size_t i;
+	int b, s = -1;
+
+	tokenize();
+	nmatches = 0;
+	pending = 0;
+	matches = matchend = NULL;
+	memset(bucketend, 0, sizeof bucketend);
+	timer.start();
+	/* exact matches go first, then prefixes, then substrings */
+	if (matchspec()) {
+		/* matched ahead of time while the user was idle */
+	} else switch ((s = plan())) {
+	case StratIndex:
+		/* show the exact and prefix matches first, find the rest afterwards */
+		matchindex();
+		schedulescan();
+		break;
+	case StratParallel:
+		/* the buckets are linked in input order afterwards */
+		if (bucketsiz < nitems) {
+			bucketsiz = nitems;
+			bucket = (signed char *)erealloc(bucket, bucketsiz);
+		}
+		pool_for(nitems, PARALLELGRAIN, matchrange, bucket);
+		for (i = 0; i < nitems; i++)
+			if (bucket[i] >= 0)
+				insertmatch(&items[i], bucket[i]);
+		break;
+	default:
+		for (item = items; item && item->text; item++) {
+			readahead(item, &lo, &hi);
+			if ((b = matchitem(item)) >= 0)
+				insertmatch(item, b);
+		}
+		break;
+	}
+	if (s >= 0) {
+		calibrate(s, timer.nsecsElapsed());
+		stats_count(CntStratScan + s, 1);
+	}
+	stats_end(StatMatch, t);
+	stats_record(StatScanned, nitems);
+	stats_record(StatMatches, nmatches);
+	curr = sel = matches;
+	if (drw) /* there are no pages to lay out in filter mode */
+		calcoffsets();
+	specstart();
+}
+
+/* match the edited text now instead of at the next frame */
+static void editflush(void)
+{
+	if (!editpending)
+		return;
+	editpending = 0;
+	if (frametimer)
+		frametimer->stop();
+	match();
+	lastmatch.start();
+}
+
+static void edited(void)
 {
-	static char **tokv = NULL;
-	static int tokn = 0;
-
-	char buf[sizeof text], *s;
-	int i, tokc = 0;
-	size_t len, textsize;
-	struct item *item, *lprefix, *lsubstr, *prefixend, *substrend;
-
-	strcpy(buf, text);
-	/* separate input text into tokens to be matched individually */
-	for (s = strtok(buf, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
-		if (++tokc > tokn && !(tokv = (char **)realloc(tokv, ++tokn * sizeof *tokv)))
-			die("cannot realloc %zu bytes:", tokn * sizeof *tokv);
-	len = tokc ? strlen(tokv[0]) : 0;
-
-	matches = lprefix = lsubstr = matchend = prefixend = substrend = NULL;
-	textsize = strlen(text) + 1;
-	for (item = items; item && item->text; item++) {
-		for (i = 0; i < tokc; i++)
-			if (!fstrstr(item->text, tokv[i]))
-				break;
-		if (i != tokc) /* not all tokens match */
-			continue;
-		/* exact matches go first, then prefixes, then substrings */
-		if (!tokc || !fstrncmp(text, item->text, textsize))
-			appenditem(item, &matches, &matchend);
-		else if (!fstrncmp(tokv[0], item->text, len))
-			appenditem(item, &lprefix, &prefixend);
+	qint64 t;
+
+	editpending = 1;
+	/* an edit after a quiet frame is matched at once; edits following it
+	 * closer than a frame apart are matched together when the frame ends */
+	if (!frametimer) {
+		editflush();
+	} else if (!frametimer->isActive()) {
+		t = lastmatch.isValid() ? lastmatch.elapsed() : framems;
+		if (t >= framems)
+			editflush();
 		else
-			appenditem(item, &lsubstr, &substrend);
-	}
-	if (lprefix) {
-		if (matches) {
-			matchend->right = lprefix;
-			lprefix->left = matchend;
-		} else
-			matches = lprefix;
-		matchend = prefixend;
-	}
-	if (lsubstr) {
-		if (matches) {
-			matchend->right = lsubstr;
-			lsubstr->left = matchend;
-		} else
-			matches = lsubstr;
-		matchend = substrend;
+			frametimer->start(framems - t);
 	}
-	curr = sel = matches;
-	calcoffsets();
 }
 
 static void insert(const char *str, ssize_t n)
 {
-	memcpy(text, str, n + 1);
-	match();
+	if (strlen(text) + n > sizeof text - 1)
+		return;
+	/* move existing text out of the way, insert new text, and update cursor */
+	memmove(&text[cursor + n], &text[cursor], sizeof text - cursor - MAX(n, 0));
+	if (n > 0)
+		memcpy(&text[cursor], str, n);
+	cursor += n;
+	edited();
+}
+
+/* replace the whole text, as edited by the line edit */
+static void settext(const char *str, size_t n)
+{
+	n = MIN(n, sizeof text - 1);
+	memcpy(text, str, n);
+	text[n] = '\0';
+	edited();
+}
+
+/* return non-zero if the key only edits the text, which can wait for the
+ * next frame; other keys act on the matches and need them up to date */
+static int isedit(QKeyEvent *ev)
+{
+	if (ev->modifiers() & (Qt::ControlModifier | Qt::AltModifier))
+		return 0;
+	switch (ev->key()) {
+	case Qt::Key_End:
+	case Qt::Key_Escape:
+	case Qt::Key_Home:
+	case Qt::Key_Left:
+	case Qt::Key_Up:
+	case Qt::Key_Enter:
+	case Qt::Key_Return:
+	case Qt::Key_Right:
+	case Qt::Key_Down:
+	case Qt::Key_Tab:
+		return 0;
+	default:
+		return 1;
+	}
 }
 
 
@@ -376,15 +1607,152 @@ static void movewordedge(int dir)
 	}
 }
 
-static void keypress(QKeyEvent *ev)
+/* output is collected in a large buffer and written to stdout in big chunks */
+static char outbuf[1 << 20];
+static size_t outlen;
+
+static void xwrite(const char *s, size_t len)
+{
+	ssize_t n;
+
+	for (; len; s += n, len -= n)
+		if ((n = write(STDOUT_FILENO, s, len)) < 0) {
+			if (errno != EINTR)
+				die("write:");
+			n = 0;
+		}
+}
+
+static void outflush(void)
+{
+	xwrite(outbuf, outlen);
+	outlen = 0;
+}
+
+static void outwrite(const char *s, size_t len)
+{
+	if (outlen + len > sizeof outbuf) {
+		outflush();
+		if (len > sizeof outbuf) { /* too large to buffer */
+			xwrite(s, len);
+			return;
+		}
+	}
+	memcpy(outbuf + outlen, s, len);
+	outlen += len;
+}
+
+/* print s followed by the record separator: a newline, NUL with -z or the -R byte */
+static void outline(const char *s, size_t len)
+{
+	outwrite(s, len);
+	outwrite(&recsep, 1);
+}
+
+/* print the output field of item */
+static void putitem(const struct item *item)
+{
+	size_t len;
+	const char *s = itemfield(item, outfield, &len);
+
+	outline(s, len);
+}
+
+/* Exit once the selection is out. stdout is closed first so a pipeline
+ * reading it goes on at once, and the items, caches and window are left to
+ * the kernel instead of being freed one by one; builds with -DLEAKCHECK
+ * tear everything down for leak checkers. With -S the exit handlers still
+ * run to write the report. */
+static void quit(int status)
+{
+	outflush();
+	close(STDOUT_FILENO);
+#ifdef LEAKCHECK
+	cleanup();
+	exit(status);
+#else
+	shm_detach(); /* the segment outlives us until the last instance is gone */
+	if (stats)
+		exit(status);
+	_exit(status);
+#endif
+}
+
+/* mark all matches, or unmark them if they are all marked */
+static void markall(void)
+{
+	struct item *item;
+	int all = 1;
+
+	matchflush();
+	for (item = matches; item && all; item = item->right)
+		all = ismarked(item);
+	for (item = matches; item; item = item->right)
+		mark(item, !all);
+}
+
+/* print the marked items in input order; with markorder the marked
+ * matches come first, in match order */
+static void putmarks(void)
+{
+	struct item *item;
+	unsigned long long bits;
+	size_t w;
+
+	if (markorder) {
+		matchflush();
+		for (item = matches; item; item = item->right)
+			if (ismarked(item)) {
+				putitem(item);
+				mark(item, 0);
+			}
+	}
+	for (w = 0; w < markwords; w++)
+		for (bits = marks[w]; bits; bits &= bits - 1)
+			putitem(&items[w * 64 + __builtin_ctzll(bits)]);
+}
+
+/* line editing without -W, where there is no line edit to do it */
+static void editkey(QKeyEvent *ev, const char *buf, int len)
 {
+	switch (ev->key()) {
+	case Qt::Key_Delete:
+		if (text[cursor] == '\0')
+			return;
+		cursor = nextrune(+1);
+		// fallthrough
+	case Qt::Key_Backspace:
+		if (cursor > 0)
+			insert(NULL, nextrune(-1) - cursor);
+		break;
+	default:
+		if (len > 0 && !iscntrl((unsigned char)*buf))
+			insert(buf, len);
+		break;
+	}
+}
 
-	QByteArray byteArray = ((DMenuWindow *)drw->win)->getText().toUtf8();
+static void keypress(QKeyEvent *ev)
+{
+	DMenuWindow *win = (DMenuWindow *)drw->win;
+	QByteArray byteArray;
+
+	if (win) {
+		/* the line edit did the editing already, take over its text */
+		byteArray = win->getText().toUtf8();
+		int cursorPos = win->getLineEdit()->cursorPosition();
+		/* text and cursor are in UTF-8 bytes, the line edit counts UTF-16 units */
+		cursor = win->getText().left(cursorPos).toUtf8().size();
+		if (strcmp(byteArray.constData(), text))
+			settext(byteArray.constData(), byteArray.size());
+	} else {
+		byteArray = ev->text().toUtf8();
+	}
 	const char *buf = byteArray.constData();
+	int len = byteArray.size();
 
-	int len = ((DMenuWindow *)drw->win)->getText().length();
-	int cursorPos = ((DMenuWindow *)drw->win)->getLineEdit()->cursorPosition();
-	cursor = cursorPos;
+	if (!isedit(ev))
+		editflush();
 
 	// Ctrl pressed
 	if(ev->modifiers() & Qt::ControlModifier) {
@@ -405,15 +1773,26 @@ static void keypress(QKeyEvent *ev)
 			case Qt::Key_Y:
 				{
 					QClipboard *clipboard = QApplication::clipboard();
-					QString text = ((DMenuWindow *)drw->win)->getText();
-					clipboard->setText(text);
+					clipboard->setText(QString::fromUtf8(text));
 				}
 				return;
+			case Qt::Key_V:
+				if (!win) {
+					QByteArray clip = QApplication::clipboard()->text().toUtf8();
+					int n = clip.indexOf('\n');
+
+					insert(clip.constData(), n < 0 ? clip.size() : n);
+				}
+				break;
+			case Qt::Key_A:
+				markall();
+				break;
 			case Qt::Key_Return:
+				if (sel)
+					mark(sel, !ismarked(sel));
 				break;
 			case Qt::Key_BracketLeft:
-				cleanup();
-				exit(1);
+				quit(1);
 			default:
 				break;
 		}
@@ -428,6 +1807,7 @@ static void keypress(QKeyEvent *ev)
 				//movewordedge(+1);
 				//goto draw;
 			case Qt::Key_J:
+				matchflush();
 				if (!next)
 					return;
 				sel = curr = next;
@@ -447,11 +1827,12 @@ static void keypress(QKeyEvent *ev)
 	else {
 		switch(ev->key()) {
 			case Qt::Key_End:
-				//if (text[cursor] != '\0') {
-				if (cursor == len) {
+				/* the line edit has moved its cursor to the end already */
+				if (win ? !win->getLineEdit()->wasatend : text[cursor] != '\0') {
 					cursor = strlen(text);
 					break;
 				}
+				matchflush();
 				if (next) {
 					// jump to end of list and position items in reverse
 					curr = matchend;
@@ -464,8 +1845,7 @@ static void keypress(QKeyEvent *ev)
 				sel = matchend;
 				break;
 			case Qt::Key_Escape:
-				cleanup();
-				exit(1);
+				quit(1);
 			case Qt::Key_Home:
 				if (sel == matches) {
 					cursor = 0;
@@ -483,21 +1863,27 @@ static void keypress(QKeyEvent *ev)
 					return;
 				// fallthrough
 			case Qt::Key_Up:
+				/* with Shift the items passed are marked */
+				if (sel && (ev->modifiers() & Qt::ShiftModifier))
+					mark(sel, 1);
 				if (sel && sel->left && (sel = sel->left)->right == curr) {
 					curr = prev;
 					calcoffsets();
 				}
+				if (sel && (ev->modifiers() & Qt::ShiftModifier))
+					mark(sel, 1);
 				break;
 			case Qt::Key_Enter:
 			case Qt::Key_Return:
-				puts((sel && !(ev->modifiers() & Qt::ShiftModifier)) ? sel->text : text);
-				if (!(ev->modifiers() & Qt::ControlModifier)) {
-					cleanup();
-					exit(0);
-				}
-				if (sel)
-					sel->out = 1;
-				break;
+				if (ev->modifiers() & Qt::ShiftModifier)
+					outline(text, strlen(text));
+				else if (nmarked)
+					putmarks();
+				else if (sel)
+					putitem(sel);
+				else
+					outline(text, strlen(text));
+				quit(0);
 			case Qt::Key_Right:
 				if (text[cursor] != '\0') {
 					cursor = nextrune(+1);
@@ -507,63 +1893,863 @@ static void keypress(QKeyEvent *ev)
 					return;
 				// fallthrough
 			case Qt::Key_Down:
+				matchflush();
+				if (sel && (ev->modifiers() & Qt::ShiftModifier))
+					mark(sel, 1);
 				if (sel && sel->right && (sel = sel->right) == next) {
 					curr = next;
 					calcoffsets();
 				}
+				if (sel && (ev->modifiers() & Qt::ShiftModifier))
+					mark(sel, 1);
 				break;
 			case Qt::Key_Tab:
 				if (!sel)
 					return;
-				cursor = strnlen(sel->text, sizeof text - 1);
-				memcpy(text, sel->text, cursor);
+				{
+					size_t flen;
+					const char *f = itemfield(sel, dispfield, &flen);
+
+					cursor = MIN(flen, sizeof text - 1);
+					memcpy(text, f, cursor);
+				}
 				text[cursor] = '\0';
 				match();
 				break;
 			default:
-				insert(buf, len);
+				if (!win)
+					editkey(ev, buf, len);
 				break;
 		}
 	}
 
 draw:
-	drawmenu();
+	if (win)
+		win->setText(text, cursor);
+	/* a pending edit is drawn with its matches */
+	if (!editpending)
+		drawmenu();
 }
 
 static void paste(void)
 {
 }
 
-static void readstdin(void)
+static struct item *rebaseptr(struct item *p, uintptr_t old)
 {
-	char *line = NULL;
-	size_t i, itemsiz = 0, linesiz = 0;
-	ssize_t len;
+	return p ? items + ((uintptr_t)p - old) / sizeof(*items) : NULL;
+}
+
+/* fix up the pointers into items after it moved from old */
+static void rebase(uintptr_t old)
+{
+	struct item *item;
+	int i;
+
+	matches = rebaseptr(matches, old);
+	matchend = rebaseptr(matchend, old);
+	prev = rebaseptr(prev, old);
+	curr = rebaseptr(curr, old);
+	next = rebaseptr(next, old);
+	sel = rebaseptr(sel, old);
+	for (i = 0; i < MatchLast; i++)
+		bucketend[i] = rebaseptr(bucketend[i], old);
+	for (item = matches; item; item = item->right) {
+		item->left = rebaseptr(item->left, old);
+		item->right = rebaseptr(item->right, old);
+	}
+}
+
+/* make room for n items and the terminating one */
+static void growitems(size_t n)
+{
+	uintptr_t old = (uintptr_t)items;
+
+	if (n < itemsiz)
+		return;
+	itemsiz = MAX(itemsiz ? itemsiz * 2 : 256, n + 1);
+	items = (struct item *)erealloc(items, itemsiz * sizeof(*items));
+	if (old && (uintptr_t)items != old)
+		rebase(old);
+}
+
+/* make room for n field spans */
+static void growspans(size_t n)
+{
+	if (n <= spansiz)
+		return;
+	spansiz = MAX(spansiz * 2, n);
+	spans = (Span *)erealloc(spans, spansiz * sizeof(*spans));
+}
+
+/* add an item whose dedup hash h (with -u) and nfields fields (with -d)
+ * were found already; fields NULL splits them here */
+static struct item *addparsed(const char *line, size_t len, unsigned long long h, unsigned long long sig,
+                              const Span *fields, unsigned int nfields)
+{
+	struct item *item;
+	long dup;
+
+	if (unique) {
+		if ((dup = dedup_find(h, line, len)) >= 0) {
+			items[dup].count++;
+			return NULL;
+		}
+	}
+	growitems(nitems + 1);
+	item = &items[nitems++];
+	item->text = arena_add(line, len);
+	item->count = 1;
+	item->sig = sig;
+	itembytes += len;
+	for (; sig; sig &= sig - 1)
+		sigfreq[__builtin_ctzll(sig)]++;
+	if (unique)
+		dedup_add(h, item->text, len, item - items);
+	item->nfields = 0;
+	if (delim && !fields) {
+		splitfields(item, len);
+	} else if (delim) {
+		growspans(nspans + nfields);
+		memcpy(spans + nspans, fields, nfields * sizeof(*spans));
+		item->field = nspans;
+		item->nfields = nfields;
+		nspans += nfields;
+	}
+	items[nitems].text = NULL;
+	return item;
+}
+
+static struct item *additem(const char *line, size_t len)
+{
+	return addparsed(line, len, unique ? dedup_hash(line, len) : 0, textsig(line, len), NULL, 0);
+}
+
+static void freeitems(void)
+{
+	arena_free();
+	dedup_clear();
+	nindexed = 0;
+	pending = 0;
+	nitems = nspans = itembytes = nmarked = 0;
+	if (marks)
+		memset(marks, 0, markwords * sizeof(*marks));
+	memset(sigfreq, 0, sizeof sigfreq);
+	if (items)
+		items[0].text = NULL;
+	matches = matchend = prev = curr = next = sel = NULL;
+	memset(bucketend, 0, sizeof bucketend);
+	drw_tiles_clear(drw); /* cached rows, highlights and previews are keyed by item index */
+	preview_clear();
+	speccancel();
+	if (speccache)
+		speccache->clear();
+	querygen++;
+	pvsel = NULL;
+}
+
+/* add a record without its separator, and the CR of a CRLF line end */
+static void addrecord(char *s, size_t len)
+{
+	if (recsep == '\n' && len && s[len - 1] == '\r')
+		len--;
+	additem(s, len);
+}
+
+static void readblocks(void)
+{
+	char *buf, *p, *end, *sep;
+	size_t bufsiz = READBLOCK, fill = 0, scan = 0;
+	ssize_t n;
+
+	/* read stdin in large blocks and split them at the separators; a
+	 * record cut off at the end of a block moves to the front for the next */
+	buf = (char *)ecalloc(1, bufsiz);
+	for (;;) {
+		if (fill == bufsiz) {
+			bufsiz *= 2;
+			buf = (char *)erealloc(buf, bufsiz);
+		}
+		if ((n = read(0, buf + fill, bufsiz - fill)) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("read:");
+		}
+		if (!n)
+			break;
+		fill += n;
+		end = buf + fill;
+		/* the carried over part was searched already */
+		for (p = buf; (sep = (char *)memchr(buf + scan, recsep, end - buf - scan)); scan = sep + 1 - buf) {
+			addrecord(p, sep - p);
+			p = sep + 1;
+		}
+		fill = end - p;
+		memmove(buf, p, fill);
+		scan = fill;
+	}
+	if (fill) /* last record without a separator */
+		addrecord(buf, fill);
+	free(buf);
+}
 
-	/* read each line from stdin and add it to the item list */
-	for (i = 0; (len = getline(&line, &linesiz, stdin)) != -1; i++) {
-		if (i + 1 >= itemsiz) {
-			itemsiz += 256;
-			if (!(items = (struct item *)realloc(items, itemsiz * sizeof(*items))))
-				die("cannot realloc %zu bytes:", itemsiz * sizeof(*items));
+/* the end of the record containing p, at most end */
+static const char *recend(const char *p, const char *end)
+{
+	const char *sep;
+
+	if (p >= end)
+		return end;
+	sep = (const char *)memchr(p, recsep, end - p);
+	return sep ? sep + 1 : end;
+}
+
+/* find the records of each chunk, with their dedup hashes and fields */
+static void parsechunks(size_t lo, size_t hi, void *arg)
+{
+	Chunk *c;
+	Rec *r;
+	const char *p, *sep;
+	size_t len;
+
+	for (c = (Chunk *)arg + lo; lo < hi; lo++, c++) {
+		c->nrecs = c->nspans = c->textsize = 0;
+		for (p = c->lo; p < c->hi; p = sep + 1) {
+			if (!(sep = (const char *)memchr(p, recsep, c->hi - p)))
+				sep = c->hi;
+			len = sep - p;
+			if (recsep == '\n' && len && p[len - 1] == '\r')
+				len--;
+			if (c->nrecs >= c->recsiz) {
+				c->recsiz = c->recsiz ? c->recsiz * 2 : 4096;
+				c->recs = (Rec *)erealloc(c->recs, c->recsiz * sizeof(*c->recs));
+			}
+			r = &c->recs[c->nrecs++];
+			r->s = p;
+			r->len = len;
+			r->h = unique ? dedup_hash(p, len) : 0;
+			r->sig = textsig(p, len);
+			r->field = r->nfields = 0;
+			if (delim) {
+				r->field = c->nspans;
+				r->nfields = fieldspans(p, len, &c->spans, &c->nspans, &c->spansiz);
+			}
+			r->count = 1;
+			r->dup = 0;
+			c->textsize += len + 1;
+		}
+		c->nkept = c->nrecs;
+		c->nkeptspans = c->nspans;
+	}
+}
+
+/* with -u, mark the records of the chunks that repeat an earlier one and
+ * count them with it; in input order, so the first occurrence is kept */
+static void dedupchunks(Chunk *chunks, size_t nchunks)
+{
+	Chunk *c;
+	Rec *r, **kept;
+	size_t i, j, n, idx = nitems;
+	long d;
+
+	for (i = n = 0; i < nchunks; i++)
+		n += chunks[i].nrecs;
+	/* the records of the items not made yet, by item index */
+	kept = (Rec **)ecalloc(MAX(n, 1), sizeof(*kept));
+	for (i = 0, c = chunks; i < nchunks; i++, c++) {
+		for (j = 0, r = c->recs; j < c->nrecs; j++, r++) {
+			if ((d = dedup_find(r->h, r->s, r->len)) < 0) {
+				dedup_add(r->h, r->s, r->len, idx);
+				kept[idx++ - nitems] = r;
+				continue;
+			}
+			if ((size_t)d < nitems)
+				items[d].count++;
+			else
+				kept[d - nitems]->count++;
+			r->dup = 1;
+			c->nkept--;
+			c->nkeptspans -= r->nfields;
+			c->textsize -= r->len + 1;
 		}
-		if (line[len - 1] == '\n')
-			line[len - 1] = '\0';
-		if (!(items[i].text = strdup(line)))
-			die("strdup:");
+	}
+	free(kept);
+}
 
-		items[i].out = 0;
+/* copy the kept records of each chunk to its arena space, items and
+ * field spans */
+static void fillchunks(size_t lo, size_t hi, void *arg)
+{
+	Chunk *c;
+	Rec *r;
+	struct item *item;
+	unsigned long long sig;
+	size_t j, sp;
+	char *t;
+
+	for (c = (Chunk *)arg + lo; lo < hi; lo++, c++) {
+		item = &items[c->item];
+		sp = c->span;
+		t = c->text;
+		c->itembytes = 0;
+		memset(c->sigfreq, 0, sizeof c->sigfreq);
+		for (j = 0, r = c->recs; j < c->nrecs; j++, r++) {
+			if (r->dup)
+				continue;
+			memcpy(t, r->s, r->len);
+			t[r->len] = '\0';
+			item->text = t;
+			item->count = r->count;
+			item->sig = r->sig;
+			item->field = sp;
+			item->nfields = r->nfields;
+			if (r->nfields)
+				memcpy(spans + sp, c->spans + r->field, r->nfields * sizeof(*spans));
+			t += r->len + 1;
+			sp += r->nfields;
+			c->itembytes += r->len;
+			for (sig = r->sig; sig; sig &= sig - 1)
+				c->sigfreq[__builtin_ctzll(sig)]++;
+			item++;
+		}
 	}
-	free(line);
+}
+
+/* Read a large regular file on stdin through a mapping. It is taken in
+ * windows of records; the chunks of a window are parsed on the worker pool,
+ * with -u their duplicates removed in input order, and then the workers
+ * copy each chunk to its own range of the items, spans and arena. Returns 0
+ * if it cannot be mapped. */
+static int readmapped(off_t off, off_t size)
+{
+	Chunk *chunks;
+	const char *map, *p, *end, *wend;
+	size_t nchunks = pool_threads() * 2, i, j, n, nsp;
+
+	if ((map = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, 0, 0)) == MAP_FAILED)
+		return 0;
+	madvise((void *)map, size, MADV_SEQUENTIAL);
+	chunks = (Chunk *)ecalloc(nchunks, sizeof(*chunks));
+	for (p = map + off, end = map + size; p < end; p = wend) {
+		wend = recend(p + MIN((size_t)(end - p), INGESTWINDOW), end);
+		for (i = 0; i < nchunks; i++) {
+			chunks[i].lo = i ? chunks[i - 1].hi : p;
+			chunks[i].hi = recend(p + (wend - p) * (i + 1) / nchunks, wend);
+		}
+		chunks[nchunks - 1].hi = wend;
+		pool_for(nchunks, 1, parsechunks, chunks);
+		if (unique)
+			dedupchunks(chunks, nchunks);
+		/* lay the chunks out one after the other */
+		for (i = 0, n = nitems, nsp = nspans; i < nchunks; i++) {
+			chunks[i].item = n;
+			chunks[i].span = nsp;
+			chunks[i].text = chunks[i].textsize ? arena_alloc(chunks[i].textsize) : NULL;
+			n += chunks[i].nkept;
+			nsp += chunks[i].nkeptspans;
+		}
+		growitems(n);
+		growspans(nsp);
+		pool_for(nchunks, 1, fillchunks, chunks);
+		for (i = 0; i < nchunks; i++) {
+			itembytes += chunks[i].itembytes;
+			for (j = 0; j < LENGTH(sigfreq); j++)
+				sigfreq[j] += chunks[i].sigfreq[j];
+		}
+		nitems = n;
+		nspans = nsp;
+		items[nitems].text = NULL;
+	}
+	/* the dedup table points into the mapping; nothing is added after stdin */
+	if (unique)
+		dedup_clear();
+	for (i = 0; i < nchunks; i++) {
+		free(chunks[i].recs);
+		free(chunks[i].spans);
+	}
+	free(chunks);
+	munmap((void *)map, size);
+	return 1;
+}
+
+/* The shared item store: a header, the items, their field spans, the
+ * prefix index and the item texts, each NUL terminated. Only the texts are
+ * used in place; the rest is copied to the heap, as it is small or changes. */
+typedef struct {
+	uint64_t nitems, nspans, nindexed, itembytes, textsize;
+	uint64_t sigfreq[64];
+} StoreHeader;
+
+typedef struct {
+	uint64_t text;        /* offset in the texts */
+	uint64_t field, sig;
+	uint32_t count, nfields;
+} StoreItem;
+
+/* key of the input: the file it is read from and the options that change
+ * how it is parsed and indexed */
+static unsigned long long inputkey(const struct stat *st, off_t off)
+{
+	char buf[256];
+	int n;
+
+	n = snprintf(buf, sizeof buf, "%llu %llu %lld %lld.%09ld %lld %d %d %d %d %d",
+	             (unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+	             (long long)st->st_size, (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+	             (long long)off, recsep, unique, delim, nmatchfields ? matchfields[0] : 0,
+	             fstrncmp == strncmp);
+	return dedup_hash(buf, n) | 1; /* never 0 */
+}
+
+/* use the items another instance published under key */
+static int loadstore(unsigned long long key)
+{
+	const StoreHeader *h;
+	const StoreItem *si;
+	const Span *sp;
+	const uint64_t *ix;
+	const char *p, *txt;
+	size_t size, i;
+
+	if (!(p = (const char *)shm_attach(key, STOREVERSION, &size)))
+		return 0;
+	h = (const StoreHeader *)p;
+	si = (const StoreItem *)(h + 1);
+	/* the sections must lie within the segment and the texts end in a NUL */
+	if (size < sizeof *h || h->nitems > (size - sizeof *h) / sizeof *si)
+		goto fail;
+	sp = (const Span *)(si + h->nitems);
+	if (h->nspans > (size - ((const char *)sp - p)) / sizeof *sp)
+		goto fail;
+	ix = (const uint64_t *)(sp + h->nspans);
+	if (h->nindexed > (size - ((const char *)ix - p)) / sizeof *ix)
+		goto fail;
+	txt = (const char *)(ix + h->nindexed);
+	if (h->textsize != size - (txt - p) || !h->textsize || txt[h->textsize - 1])
+		goto fail;
+
+	itemsiz = h->nitems + 1;
+	items = (struct item *)erealloc(items, itemsiz * sizeof(*items));
+	for (i = 0; i < h->nitems; i++) {
+		if (si[i].text >= h->textsize || si[i].field + si[i].nfields > h->nspans)
+			goto fail;
+		items[i].text = (char *)txt + si[i].text;
+		items[i].count = si[i].count;
+		items[i].field = si[i].field;
+		items[i].nfields = si[i].nfields;
+		items[i].sig = si[i].sig;
+	}
+	if (h->nindexed && h->nindexed != h->nitems)
+		goto fail;
+	spansiz = h->nspans;
+	spans = (Span *)erealloc(spans, MAX(spansiz, 1) * sizeof(*spans));
+	sorted = (size_t *)erealloc(sorted, MAX(h->nindexed, 1) * sizeof(*sorted));
+	memcpy(spans, sp, h->nspans * sizeof(*spans));
+	for (i = 0; i < h->nindexed; i++)
+		if ((sorted[i] = ix[i]) >= h->nitems)
+			goto fail;
+	nitems = h->nitems;
+	nspans = h->nspans;
+	nindexed = h->nindexed;
+	itembytes = h->itembytes;
+	for (i = 0; i < LENGTH(sigfreq); i++)
+		sigfreq[i] = h->sigfreq[i];
+	items[nitems].text = NULL;
+	return stored = 1;
+fail:
 	if (items)
-		items[i].text = NULL;
-	lines = MIN(lines, i);
+		items[0].text = NULL;
+	shm_detach();
+	return 0;
+}
+
+/* publish the items under storekey for other instances, then use the
+ * published texts instead of the arena */
+static void savestore(void)
+{
+	StoreHeader *h;
+	StoreItem *si;
+	uint64_t *ix;
+	char *p, *txt;
+	size_t size, textsize = 0, len, i;
+
+	if (!storekey || !nitems)
+		return;
+	for (i = 0; i < nitems; i++)
+		textsize += strlen(items[i].text) + 1;
+	size = sizeof *h + nitems * sizeof *si + nspans * sizeof(*spans) +
+	       nindexed * sizeof *ix + textsize;
+	if (!(p = (char *)shm_create(storekey, STOREVERSION, size)))
+		return;
+	h = (StoreHeader *)p;
+	h->nitems = nitems;
+	h->nspans = nspans;
+	h->nindexed = nindexed;
+	h->itembytes = itembytes;
+	h->textsize = textsize;
+	for (i = 0; i < LENGTH(sigfreq); i++)
+		h->sigfreq[i] = sigfreq[i];
+	si = (StoreItem *)(h + 1);
+	memcpy(si + nitems, spans, nspans * sizeof(*spans));
+	ix = (uint64_t *)((Span *)(si + nitems) + nspans);
+	for (i = 0; i < nindexed; i++)
+		ix[i] = sorted[i];
+	txt = (char *)(ix + nindexed);
+	for (i = 0, textsize = 0; i < nitems; i++, textsize += len) {
+		len = strlen(items[i].text) + 1;
+		memcpy(txt + textsize, items[i].text, len);
+		si[i].text = textsize;
+		si[i].field = items[i].field;
+		si[i].sig = items[i].sig;
+		si[i].count = items[i].count;
+		si[i].nfields = items[i].nfields;
+		items[i].text = txt + textsize;
+	}
+	shm_publish();
+	/* nothing points into the arena any more */
+	dedup_clear();
+	arena_free();
+	stored = 1;
+}
+
+/* with -U, order the items read most frequent first, ties keeping their
+ * input order */
+static void countsort(void)
+{
+	if (unique < 2)
+		return;
+	std::stable_sort(items, items + nitems, [](const struct item &a, const struct item &b) {
+		return a.count > b.count;
+	});
+	dedup_clear(); /* indices changed, and there is nothing more to add */
+}
+
+static void readstdin(void)
+{
+	struct stat st;
+	off_t off = -1;
+	int reg = !fstat(0, &st) && S_ISREG(st.st_mode) && (off = lseek(0, 0, SEEK_CUR)) >= 0;
+
+	if (shared && reg && loadstore(inputkey(&st, off))) {
+		lseek(0, 0, SEEK_END);
+		lines = MIN(lines, nitems);
+		return;
+	}
+	if (shared && reg)
+		storekey = inputkey(&st, off);
+	if (reg && st.st_size - off >= INGESTMIN && readmapped(off, st.st_size))
+		lseek(0, 0, SEEK_END);
+	else
+		readblocks();
+	countsort();
+	lines = MIN(lines, nitems);
+}
+
+static void readpath(void)
+{
+	path_items([](const char *name, size_t len) {
+		additem(name, len);
+	});
+	countsort();
+	lines = MIN(lines, nitems);
+}
+
+/* select the items with the given texts again after the item list was rebuilt */
+static void restoresel(const char *seltext, const char *currtext)
+{
+	struct item *item, *s = NULL, *c = NULL;
+
+	for (item = matches; item && (!s || !c); item = item->right) {
+		if (!s && seltext && !strcmp(item->text, seltext))
+			s = item;
+		if (!c && currtext && !strcmp(item->text, currtext))
+			c = item;
+	}
+	if (s)
+		sel = s;
+	if (c)
+		curr = c;
+	calcoffsets();
+	/* keep the selection on the visible page */
+	for (item = curr; item && item != next && item != sel; item = item->right)
+		;
+	if (sel && item != sel) {
+		curr = sel;
+		calcoffsets();
+	}
+}
+
+/* match the items from index first on against the current input */
+static void matchnew(size_t first)
+{
+	const char *lo = NULL, *hi = NULL;
+	size_t i;
+	int b;
+
+	/* what was matched ahead of time lacks the new items */
+	speccancel();
+	if (speccache)
+		speccache->clear();
+	for (i = first; i < nitems; i++) {
+		readahead(&items[i], &lo, &hi);
+		if ((b = matchitem(&items[i])) >= 0)
+			insertmatch(&items[i], b);
+	}
+	if (!curr)
+		curr = sel = matches;
+	calcoffsets();
+}
+
+/* (re)load the live input file: appended lines are added and matched
+ * incrementally, a replaced or truncated file is read from scratch */
+static void loadlive(void)
+{
+	static ino_t ino;
+	static off_t off;                  /* bytes consumed so far */
+	static char tail[64];              /* last bytes consumed, to detect rewrites */
+	static size_t taillen;
+	static int partial;                /* the last record consumed had no separator */
+	char *line = NULL, buf[sizeof tail], *seltext = NULL, *currtext = NULL;
+	size_t first, linesiz = 0;
+	ssize_t len;
+	struct stat st;
+	FILE *fp;
+	int rewritten;
+
+	if (!(fp = fopen(livefile, "r"))) {
+		if (ino) /* being replaced, wait for the next event */
+			return;
+		die("cannot open %s:", livefile);
+	}
+	if (fstat(fileno(fp), &st) < 0)
+		die("fstat:");
+	rewritten = st.st_ino != ino || st.st_size < off;
+	if (!rewritten && taillen)
+		rewritten = pread(fileno(fp), buf, taillen, off - taillen) != (ssize_t)taillen ||
+		            memcmp(buf, tail, taillen);
+	/* what is appended to a record taken without its separator continues it */
+	if (!rewritten && partial && st.st_size > off)
+		rewritten = 1;
+	if (rewritten) {
+		seltext = sel ? strdup(sel->text) : NULL;
+		currtext = curr ? strdup(curr->text) : NULL;
+		freeitems();
+		ino = st.st_ino;
+		off = 0;
+		partial = 0;
+	}
+	if (fseeko(fp, off, SEEK_SET) < 0)
+		die("fseeko:");
+	first = nitems;
+	while ((len = getdelim(&line, &linesiz, recsep, fp)) != -1) {
+		if (line[len - 1] != recsep) {
+			/* the last record is taken without its separator when the
+			 * whole file is read, otherwise the rest is waited for */
+			if (!rewritten)
+				break;
+			partial = 1;
+			off += len;
+			addrecord(line, len);
+			break;
+		}
+		off += len;
+		line[--len] = '\0';
+		addrecord(line, len);
+	}
+	taillen = MIN((size_t)off, sizeof tail);
+	if (taillen && pread(fileno(fp), tail, taillen, off - taillen) != (ssize_t)taillen)
+		taillen = 0;
+	free(line);
+	fclose(fp);
+
+	/* the initial load is matched by setup() */
+	if (drw && (drw->win || drw->rwin)) {
+		if (rewritten) {
+			buildindex();
+			match();
+			matchflush();
+			restoresel(seltext, currtext);
+		} else if (first < nitems) {
+			matchflush();
+			matchnew(first);
+		}
+		drawmenu();
+	}
+	free(seltext);
+	free(currtext);
+}
+
+#ifdef __linux__
+static void liveevent(int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	const char *name;
+	ssize_t n, i;
+	int changed = 0;
+
+	if ((name = strrchr(livefile, '/')))
+		name++;
+	else
+		name = livefile;
+	/* drain all pending events so a burst of writes causes a single reload */
+	while ((n = read(fd, buf, sizeof buf)) > 0)
+		for (i = 0; i < n; i += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)(buf + i);
+			if (ev->len && !strcmp(ev->name, name))
+				changed = 1;
+		}
+	if (changed)
+		loadlive();
+}
+
+/* watch the directory of the live file, so replacing the file by rename is noticed */
+static void watchlive(void)
+{
+	char dir[PATH_MAX];
+	const char *slash;
+	int fd;
+
+	if ((slash = strrchr(livefile, '/')))
+		snprintf(dir, sizeof dir, "%.*s", (int)(slash - livefile + 1), livefile);
+	else
+		strcpy(dir, ".");
+	if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		die("inotify_init1:");
+	if (inotify_add_watch(fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+		die("inotify_add_watch %s:", dir);
+	QSocketNotifier *notifier = new QSocketNotifier(fd, QSocketNotifier::Read);
+	QObject::connect(notifier, &QSocketNotifier::activated, [fd]() { liveevent(fd); });
+}
+#else
+static void watchlive(void)
+{
+	fputs("warning: no inotify support, -L reads the file only once\n", stderr);
 }
+#endif
 
 static void run(void)
 {
 }
 
+/* deliver a key to the line edit like the window system would and time it
+ * until the result is painted, including any wait for the frame timer */
+static void replaykey(int key, Qt::KeyboardModifiers mod, const char *text)
+{
+	DMenuWindow *w = (DMenuWindow *)drw->win;
+	unsigned long long t = stats_begin();
+	QKeyEvent ev(QEvent::KeyPress, key, mod, QString::fromUtf8(text));
+
+	if (w)
+		QCoreApplication::sendEvent(w->getLineEdit(), &ev);
+	else
+		QCoreApplication::sendEvent(drw->rwin, &ev);
+	while (editpending)
+		QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+	if (w)
+		w->repaint();
+	else
+		((DMenuRasterWindow *)drw->rwin)->paint();
+	stats_end(StatKey, t);
+	/* once all matches are found, one of them must be selected */
+	while (pending)
+		QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+	if (matches && !sel)
+		replayerrors++;
+}
+
+/* whether the top left pixel of the menu, the prompt or else the input
+ * field, has the background of clrs */
+static int themedrawn(const char *clrs[][2])
+{
+	QColor bg(clrs[prompt && *prompt ? SchemeSel : SchemeNorm][ColBg]);
+
+	return drw->drawable->toImage().pixelColor(0, 0).rgba() == bg.rgba();
+}
+
+/* switch to the theme with the normal and selected colors swapped and
+ * back, checking the menu is redrawn in each */
+static int replaytheme(void)
+{
+	const char *swapped[SchemeLast][2];
+	int ok;
+
+	memcpy(swapped, colors, sizeof swapped);
+	swapped[SchemeNorm][ColBg] = colors[SchemeSel][ColBg];
+	swapped[SchemeNorm][ColFg] = colors[SchemeSel][ColFg];
+	swapped[SchemeSel][ColBg] = colors[SchemeNorm][ColBg];
+	swapped[SchemeSel][ColFg] = colors[SchemeNorm][ColFg];
+	settheme(swapped);
+	ok = themedrawn(swapped);
+	settheme(colors);
+	return ok && themedrawn(colors);
+}
+
+/* type a query taken from the items, from their start and, every other
+ * round, from their second character, page through the matches, jump to
+ * the ends and erase the query again, then exit non-zero if the median or
+ * 99th percentile key latency is over the -T limits, a key left the
+ * matches without a selection or a theme switch did not redraw */
+static void replay(void)
+{
+	const char *s, *item = nitems ? items[nitems / 2].text : "";
+	char c[2] = "";
+	double p50, p99;
+	int round, i, n, themeok;
+
+	for (round = 0; round < REPLAYROUNDS; round++) {
+		s = round % 2 && *item ? item + 1 : item;
+		for (n = 0; n < 8 && isprint((unsigned char)s[n]); n++) {
+			c[0] = s[n];
+			replaykey(toupper((unsigned char)c[0]), Qt::NoModifier, c);
+		}
+		for (i = 0; i < 10; i++)
+			replaykey(Qt::Key_J, Qt::AltModifier, "");
+		for (i = 0; i < 10; i++)
+			replaykey(Qt::Key_K, Qt::AltModifier, "");
+		/* with the cursor at the end, End and Home jump through the list */
+		replaykey(Qt::Key_Down, Qt::NoModifier, "");
+		replaykey(Qt::Key_End, Qt::NoModifier, "");
+		replaykey(Qt::Key_Home, Qt::NoModifier, "");
+		while (n--)
+			replaykey(Qt::Key_Backspace, Qt::NoModifier, "\b");
+	}
+	themeok = replaytheme();
+	p50 = stats_percentile(StatKey, 0.5) / 1e6;
+	p99 = stats_percentile(StatKey, 0.99) / 1e6;
+	fprintf(stderr, "qdmenu: %zu items, key latency p50 %.2f ms (limit %.2f), p99 %.2f ms (limit %.2f)\n",
+	        nitems, p50, replay50, p99, replay99);
+	if (replayerrors)
+		fprintf(stderr, "qdmenu: %d keys left the matches without a selection\n", replayerrors);
+	if (!themeok)
+		fprintf(stderr, "qdmenu: switching the theme did not redraw the menu in its colors\n");
+	quit(p50 > replay50 || p99 > replay99 || replayerrors || !themeok);
+}
+
+
+/* Parse clrs into the schemes and their palettes. Called again to switch
+ * themes at runtime, it updates them in place and redraws. */
+static void settheme(const char *clrs[][2])
+{
+	int i, j;
+
+	for (i = 0; i < SchemeLast; i++) {
+		if (!scheme[i])
+			scheme[i] = drw_scm_create(drw, clrs[i], 2);
+		else
+			for (j = 0; j < 2; j++)
+				drw_clr_create(drw, &scheme[i][j], clrs[i][j]);
+		palette[i].setColor(QPalette::Window, scheme[i][ColBg].color);
+		palette[i].setColor(QPalette::Base, scheme[i][ColBg].color);
+		palette[i].setColor(QPalette::WindowText, scheme[i][ColFg].color);
+		palette[i].setColor(QPalette::Text, scheme[i][ColFg].color);
+	}
+	drw_tiles_clear(drw); /* cached rows have the old colors */
+	if (drw->win)
+		((DMenuWindow *)drw->win)->setTheme(palette[SchemeNorm]);
+	if (drw->win || drw->rwin)
+		drawmenu();
+}
 
 static void setup(QApplication *app)
 {
@@ -576,8 +2762,9 @@ static void setup(QApplication *app)
 	int a, di, n, area = 0;
 #endif
 	// init appearance
-	for (j = 0; j < SchemeLast; j++)
-		scheme[j] = drw_scm_create(drw, colors[j], 2);
+	drw_tiles_create(drw, tilecachekb);
+	settheme(colors);
+	speccache = new QCache<QByteArray, QByteArray>(speccachekb);
 
 	// calculate menu geometry 
 	bh = drw->fonts->h + 2;
@@ -623,32 +2810,133 @@ static void setup(QApplication *app)
 
 	promptw = (prompt && *prompt) ? TEXTW(prompt) - lrpad / 4 : 0;
 	inputw = mw / 3; // input width: ~33% of monitor width
+	if (preview && lines > 0) {
+		pvw = mw * previewwidth / 100;
+		preview_init(previewcmd, previewcachekb, previewdelay, previewdone);
+	}
 	match();
 
-	DMenuWindow *window = new DMenuWindow();
-    window->setGeometry(x, y, mw, mh);
-	window->setStyleSheet(QString("background-color: %1;").arg(scheme[SchemeNorm][ColBg]->name()));
-    window->show();
-	drw->win = window;
+	if (widgets) {
+		DMenuWindow *window = new DMenuWindow();
+		window->setGeometry(x, y, mw, mh);
+		window->setTheme(palette[SchemeNorm]);
+		window->show();
+		drw->win = window;
+	} else {
+		DMenuRasterWindow *window = new DMenuRasterWindow();
+		window->setGeometry(x, y, mw, mh);
+		window->show();
+		drw->rwin = window;
+	}
+
+	framems = MAX(1, (int)(1000 / MAX(screen->refreshRate(), 1.0)));
+	frametimer = new QTimer();
+	frametimer->setSingleShot(true);
+	frametimer->setTimerType(Qt::PreciseTimer);
+	QObject::connect(frametimer, &QTimer::timeout, []() {
+		editflush();
+		drawmenu();
+	});
 
 	drw_resize(drw, mw, mh);
 	drawmenu();
 }
 
 
+static char parsedelim(const char *s)
+{
+	if (s[0] == '\\' && s[1] == 't' && !s[2])
+		return '\t';
+	if (s[0] == '\\' && s[1] == 'n' && !s[2])
+		return '\n';
+	if (!s[0] || s[1])
+		die("delimiter must be a single character");
+	return s[0];
+}
+
+static void parsefields(const char *s)
+{
+	char *end;
+	long n;
+
+	for (nmatchfields = 0; *s; s = end + (*end == ',')) {
+		if ((n = strtol(s, &end, 10)) <= 0 || end == s || (*end && *end != ','))
+			die("invalid field list: %s", s);
+		matchfields = (int *)erealloc(matchfields, (nmatchfields + 1) * sizeof(*matchfields));
+		matchfields[nmatchfields++] = n;
+	}
+}
+
+/* parse a size with an optional K, M or G suffix */
+static size_t parsesize(const char *s)
+{
+	char *end;
+	unsigned long long n;
+
+	n = strtoull(s, &end, 10);
+	switch (*end) {
+	case 'G': case 'g': n <<= 10; /* fallthrough */
+	case 'M': case 'm': n <<= 10; /* fallthrough */
+	case 'K': case 'k': n <<= 10; end++; break;
+	}
+	if (end == s || *end)
+		die("invalid size: %s", s);
+	return n;
+}
+
 static void
 usage(void)
 {
-	die("usage: dmenu [-bfiv] [-l lines] [-p prompt] [-fn font] [-m monitor]\n"
-	    "             [-nb color] [-nf color] [-sb color] [-sf color] [-w windowid]");
+	die("usage: dmenu [-bfiruUvWxzH] [-l lines] [-p prompt] [-fn font] [-m monitor]\n"
+	    "             [-nb color] [-nf color] [-sb color] [-sf color] [-w windowid]\n"
+	    "             [-d delim] [-n fields] [-D field] [-O field] [-F query]\n"
+	    "             [-L file] [-P command | -Pf] [-M size]\n"
+	    "             [-S file] [-T p50:p99] [-R sep] [-st strategy]");
+}
+
+/* run the matcher on stdin for query and print the ranked matches, without a gui */
+static int filter(const char *query)
+{
+	struct item *item;
+
+	snprintf(text, sizeof text, "%s", query);
+	if (livefile)
+		loadlive();
+	else if (pathitems)
+		readpath();
+	else
+		readstdin();
+	match();
+	for (item = matches; item; item = item->right)
+		putitem(item);
+	outflush();
+	shm_detach();
+	return matches ? 0 : 1;
 }
 
 int main(int argc, char *argv[])
 {
 	// XWindowAttributes wa;
-	QApplication app(argc, argv);
+	QApplication *app = NULL;
+	/* the options taking no argument, as parsed below */
+	static const char *flags[] = { "-v", "-b", "-f", "-r", "-u", "-U", "-Pf", "-W", "-x", "-z", "-H", "-i" };
+	const char *query = NULL;
+	size_t j;
 	int i, fast = 0;
 
+	/* filter mode must not touch the display, so look for it before Qt
+	 * parses argv, skipping the arguments of the other options */
+	for (i = 1; i < argc - 1; i++) {
+		if (!strcmp(argv[i], "-F"))
+			query = argv[i + 1];
+		for (j = 0; j < LENGTH(flags) && strcmp(argv[i], flags[j]); j++)
+			;
+		if (j == LENGTH(flags))
+			i++;
+	}
+	if (!query)
+		app = new QApplication(argc, argv);
+
 	for (i = 1; i < argc; i++)
 		/* these options take no arguments */
 		if (!strcmp(argv[i], "-v")) {      /* prints version information */
@@ -658,9 +2946,26 @@ int main(int argc, char *argv[])
 			topbar = 0;
 		else if (!strcmp(argv[i], "-f"))   /* grabs keyboard before reading stdin */
 			fast = 1;
+		else if (!strcmp(argv[i], "-r"))   /* match the input as regular expression */
+			regex = 1;
+		else if (!strcmp(argv[i], "-u"))   /* drop duplicate lines */
+			unique = 1;
+		else if (!strcmp(argv[i], "-U"))   /* drop duplicate lines, most frequent lines first */
+			unique = 2;
+		else if (!strcmp(argv[i], "-Pf"))  /* preview the head of the file named by the item */
+			preview = 1;
+		else if (!strcmp(argv[i], "-W"))   /* use a QWidget window with a QLineEdit */
+			widgets = 1;
+		else if (!strcmp(argv[i], "-x"))   /* list the executables in $PATH, like dmenu_path */
+			pathitems = 1;
+		else if (!strcmp(argv[i], "-z"))   /* records are separated by NUL instead of newline */
+			recsep = '\0';
+		else if (!strcmp(argv[i], "-H"))   /* share the parsed items with other instances */
+			shared = 1;
 		else if (!strcmp(argv[i], "-i")) { /* case-insensitive item matching */
 			fstrncmp = strncasecmp;
 			fstrstr = cistrstr;
+			fmemmem = cimemmem;
 		} else if (i + 1 == argc)
 			usage();
 		/* these options take one argument */
@@ -682,11 +2987,49 @@ int main(int argc, char *argv[])
 			colors[SchemeSel][ColFg] = argv[++i];
 		else if (!strcmp(argv[i], "-w"))   /* embedding window id */
 			embed = argv[++i];
+		else if (!strcmp(argv[i], "-d"))   /* field delimiter */
+			delim = parsedelim(argv[++i]);
+		else if (!strcmp(argv[i], "-R"))   /* record separator */
+			recsep = parsedelim(argv[++i]);
+		else if (!strcmp(argv[i], "-n"))   /* comma separated fields to match on */
+			parsefields(argv[++i]);
+		else if (!strcmp(argv[i], "-D"))   /* field to display */
+			dispfield = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-O"))   /* field to print on selection */
+			outfield = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-F"))   /* filter stdin with the given query and exit */
+			query = argv[++i];
+		else if (!strcmp(argv[i], "-L"))   /* read items from a file and follow its changes */
+			livefile = argv[++i];
+		else if (!strcmp(argv[i], "-S"))   /* write runtime statistics to a file, - for stderr */
+			stats_init(argv[++i]);
+		else if (!strcmp(argv[i], "-st")) { /* match strategy */
+			for (i++, strategy = StratLast - 1; strategy >= 0 && strcmp(argv[i], stratnames[strategy]); strategy--)
+				;
+			if (strategy < 0)
+				usage();
+		}
+		else if (!strcmp(argv[i], "-T")) { /* replay keys and check their latency in ms */
+			if (sscanf(argv[++i], "%lf:%lf", &replay50, &replay99) != 2 || replay50 <= 0 || replay99 <= 0)
+				usage();
+		}
+		else if (!strcmp(argv[i], "-M"))   /* keep at most this much item text in memory */
+			membudget = parsesize(argv[++i]);
+		else if (!strcmp(argv[i], "-P")) { /* preview the item with a command, -l only */
+			previewcmd = argv[++i];
+			preview = 1;
+		}
 		else
 			usage();
 
+	/* appended lines would have to be sorted into the list */
+	if (unique > 1 && livefile)
+		die("-U cannot be used with -L");
 	if (!setlocale(LC_CTYPE, ""))
 		fputs("warning: no locale support\n", stderr);
+	arena_init(membudget);
+	if (query)
+		return filter(query);
 	
 	// Get a pointer to the primary (default) screen
 	screen = QGuiApplication::primaryScreen();
@@ -709,7 +3052,13 @@ int main(int argc, char *argv[])
 		die("pledge");
 #endif
 	// TODO: check!
-	if (fast && !isatty(0)) {
+	if (livefile) {
+		grabkeyboard();
+		loadlive();
+	} else if (pathitems) {
+		grabkeyboard();
+		readpath();
+	} else if (fast && !isatty(0)) {
 		grabkeyboard();
 		readstdin();
 	} else {
@@ -717,12 +3066,25 @@ int main(int argc, char *argv[])
 		grabkeyboard();
 	}
 
-	setup(&app);
+	if (!stored)
+		buildindex();
+	savestore();
+	setup(app);
+	if (livefile)
+		watchlive();
 	run();
+	if (replay50) {
+		if (!stats)
+			stats_init("-");
+		QTimer::singleShot(0, replay);
+	}
 
 
-	((DMenuWindow *)drw->win)->focusEditBox();
-	return app.exec();
+	if (drw->win)
+		((DMenuWindow *)drw->win)->focusEditBox();
+	else
+		drw->rwin->requestActivate();
+	return app->exec();
 }
 
 #include "qdmenu.moc"
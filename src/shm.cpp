@@ -0,0 +1,134 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+
+#include "shm.h"
+
+#define MAGIC   "qdmenu\0"     /* 8 bytes with the terminating NUL */
+#define HDRSIZE 64             /* header, padded so the payload is aligned */
+
+typedef struct {
+	char magic[8];
+	uint32_t version;          /* of the payload layout */
+	std::atomic<uint32_t> ready; /* the payload is complete */
+	uint64_t key;
+	uint64_t size;             /* of the payload */
+} Header;
+
+static int fd = -1;
+static char name[64];
+static char *base;
+static size_t mapsize;
+
+static void segname(unsigned long long key)
+{
+	/* per user, so instances of different users never share */
+	snprintf(name, sizeof name, "/qdmenu-%u-%016llx", (unsigned int)getuid(), key);
+}
+
+const void *shm_attach(unsigned long long key, unsigned int version, size_t *size)
+{
+	struct stat st;
+	Header *h;
+
+	segname(key);
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+		return NULL;
+	/* only trust segments of our own that no one else may write */
+	if (flock(fd, LOCK_SH) || fstat(fd, &st) || st.st_uid != getuid() ||
+	    (st.st_mode & 022) || (size_t)st.st_size < HDRSIZE)
+		goto fail;
+	base = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		base = NULL;
+		goto fail;
+	}
+	mapsize = st.st_size;
+	h = (Header *)base;
+	/* a segment still being written is not waited for */
+	if (memcmp(h->magic, MAGIC, sizeof h->magic) || h->version != version || h->key != key ||
+	    !h->ready.load(std::memory_order_acquire) || h->size > mapsize - HDRSIZE)
+		goto fail;
+	*size = h->size;
+	return base + HDRSIZE;
+fail:
+	shm_detach();
+	return NULL;
+}
+
+/* remove the segment under name if no instance uses it, as one left by a
+ * publisher that crashed or by instances of another payload version */
+static int unlinkstale(void)
+{
+	int sfd, stale;
+
+	if ((sfd = shm_open(name, O_RDONLY, 0)) < 0)
+		return errno == ENOENT;
+	if ((stale = !flock(sfd, LOCK_EX | LOCK_NB)))
+		shm_unlink(name);
+	close(sfd);
+	return stale;
+}
+
+void *shm_create(unsigned long long key, unsigned int version, size_t size)
+{
+	Header *h;
+
+	segname(key);
+	while ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+		if (errno != EEXIST || !unlinkstale())
+			return NULL;
+	mapsize = HDRSIZE + size;
+	if (flock(fd, LOCK_SH) || ftruncate(fd, mapsize))
+		goto fail;
+#ifdef __linux__
+	/* fail now rather than with SIGBUS on a write if the space runs out */
+	if (posix_fallocate(fd, 0, mapsize))
+		goto fail;
+#endif
+	base = (char *)mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		base = NULL;
+		goto fail;
+	}
+	h = (Header *)base;
+	memcpy(h->magic, MAGIC, sizeof h->magic);
+	h->version = version;
+	h->key = key;
+	h->size = size;
+	return base + HDRSIZE;
+fail:
+	shm_detach();
+	return NULL;
+}
+
+void shm_publish(void)
+{
+	if (!base)
+		return;
+	((Header *)base)->ready.store(1, std::memory_order_release);
+	mprotect(base, mapsize, PROT_READ);
+}
+
+void shm_detach(void)
+{
+	if (fd < 0)
+		return;
+	/* the last instance removes the name; one attaching meanwhile still
+	 * has its mapping, later ones create a new segment */
+	if (!flock(fd, LOCK_EX | LOCK_NB))
+		shm_unlink(name);
+	if (base)
+		munmap(base, mapsize);
+	close(fd);
+	fd = -1;
+	base = NULL;
+}
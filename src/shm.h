@@ -0,0 +1,18 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Read-only data shared between instances through a POSIX shared memory
+ * segment named after a key. The first instance creates the segment, fills
+ * the payload and publishes it; later ones attach by the same key. Every
+ * instance using a segment holds a shared lock on it, which the kernel drops
+ * even if it crashes, and the last one to detach removes the name. A
+ * segment written with another payload version is not attached.
+ *
+ * shm_attach returns the payload of a published segment, NULL if there is
+ * none. shm_create returns a writable payload of size bytes, NULL if
+ * another instance uses the segment or it cannot be made; an unused one,
+ * left by a crash or another version, is replaced. shm_publish makes it
+ * read-only and visible to shm_attach. One segment per process at a time. */
+const void *shm_attach(unsigned long long key, unsigned int version, size_t *size);
+void *shm_create(unsigned long long key, unsigned int version, size_t size);
+void shm_publish(void);
+void shm_detach(void);
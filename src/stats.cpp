@@ -0,0 +1,228 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <new>
+
+#include "stats.h"
+#include "util.h"
+
+#define SUBBITS  4                        /* 16 sub-buckets per power of two */
+#define SUBCOUNT (1 << SUBBITS)
+#define NBUCKETS ((64 - SUBBITS + 1) * SUBCOUNT)
+
+typedef struct {
+	unsigned long long n, sum, min, max;
+	unsigned long long bucket[NBUCKETS];
+} Hist;
+
+/* in the order of the Stat* enum */
+static const struct {
+	const char *name;
+	int ns;
+} histinfo[] = {
+	{ "match",         1 }, /* StatMatch */
+	{ "calcoffsets",   1 }, /* StatCalcoffsets */
+	{ "drawmenu",      1 }, /* StatDrawmenu */
+	{ "paintEvent",    1 }, /* StatPaint */
+	{ "key to paint",  1 }, /* StatKey */
+	{ "items scanned", 0 }, /* StatScanned */
+	{ "match size",    0 }, /* StatMatches */
+};
+static_assert(LENGTH(histinfo) == HistLast, "histinfo must name every histogram");
+
+int stats;
+static const char *statspath;
+static Hist hists[HistLast];
+static std::atomic<unsigned long long> counters[CntLast];
+
+static unsigned int bucketof(unsigned long long v)
+{
+	unsigned int exp;
+
+	if (v < SUBCOUNT)
+		return v;
+	exp = 63 - __builtin_clzll(v) - SUBBITS + 1;
+	return exp * SUBCOUNT + (unsigned int)(v >> (exp - 1)) - SUBCOUNT;
+}
+
+/* lowest value that falls into bucket b */
+static unsigned long long bucketvalue(unsigned int b)
+{
+	unsigned int exp = b / SUBCOUNT;
+
+	if (!exp)
+		return b;
+	return (unsigned long long)(b % SUBCOUNT + SUBCOUNT) << (exp - 1);
+}
+
+static unsigned long long percentile(const Hist *h, double p)
+{
+	unsigned long long want, seen = 0;
+	unsigned int b;
+
+	want = (unsigned long long)(h->n * p + 0.5);
+	want = MAX(want, 1ULL);
+	for (b = 0; b < NBUCKETS; b++)
+		if ((seen += h->bucket[b]) >= want)
+			return MIN(MAX(bucketvalue(b), h->min), h->max);
+	return h->max;
+}
+
+static void report(void)
+{
+	const Hist *h;
+	FILE *fp;
+	double div;
+	unsigned long long hit, miss;
+	int i;
+
+	if (!strcmp(statspath, "-"))
+		fp = stderr;
+	else if (!(fp = fopen(statspath, "w"))) {
+		fprintf(stderr, "qdmenu: cannot write stats to %s\n", statspath);
+		return;
+	}
+	fprintf(fp, "%-14s %8s %10s %10s %10s %10s %10s %10s\n",
+	        "", "n", "mean", "min", "p50", "p90", "p99", "max");
+	for (i = 0; i < HistLast; i++) {
+		h = &hists[i];
+		if (!h->n)
+			continue;
+		div = histinfo[i].ns ? 1000.0 : 1.0;
+		fprintf(fp, "%-14s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f%s\n",
+		        histinfo[i].name, h->n, h->sum / div / h->n, h->min / div,
+		        percentile(h, 0.5) / div, percentile(h, 0.9) / div,
+		        percentile(h, 0.99) / div, h->max / div, histinfo[i].ns ? " us" : "");
+	}
+	hit = counters[CntTileHit];
+	miss = counters[CntTileMiss];
+	if (hit + miss)
+		fprintf(fp, "tile cache     %llu hits, %llu misses (%.1f%%)\n", hit, miss, 100.0 * hit / (hit + miss));
+	hit = counters[CntPreviewHit];
+	miss = counters[CntPreviewMiss];
+	if (hit + miss)
+		fprintf(fp, "preview cache  %llu hits, %llu misses (%.1f%%)\n", hit, miss, 100.0 * hit / (hit + miss));
+	hit = counters[CntSpecHit];
+	miss = counters[CntSpecMiss];
+	if (hit + miss)
+		fprintf(fp, "speculation    %llu hits, %llu misses (%.1f%%)\n", hit, miss, 100.0 * hit / (hit + miss));
+	if (counters[CntStratScan] + counters[CntStratParallel] + counters[CntStratIndex])
+		fprintf(fp, "strategy       %llu scan, %llu parallel, %llu index\n",
+		        (unsigned long long)counters[CntStratScan], (unsigned long long)counters[CntStratParallel],
+		        (unsigned long long)counters[CntStratIndex]);
+	fprintf(fp, "allocations    %llu, %llu bytes\n",
+	        (unsigned long long)counters[CntAllocs], (unsigned long long)counters[CntAllocBytes]);
+	if (fp != stderr)
+		fclose(fp);
+}
+
+void stats_init(const char *path)
+{
+	int i;
+
+	for (i = 0; i < HistLast; i++)
+		hists[i].min = ~0ULL;
+	statspath = path;
+	stats = 1;
+	atexit(report);
+}
+
+void stats_record(int hist, unsigned long long v)
+{
+	Hist *h = &hists[hist];
+
+	if (!stats)
+		return;
+	h->n++;
+	h->sum += v;
+	h->min = MIN(h->min, v);
+	h->max = MAX(h->max, v);
+	h->bucket[bucketof(v)]++;
+}
+
+unsigned long long stats_percentile(int hist, double p)
+{
+	return hists[hist].n ? percentile(&hists[hist], p) : 0;
+}
+
+void stats_count(int counter, unsigned long long n)
+{
+	if (stats)
+		counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long long stats_begin(void)
+{
+	return stats ? now() : 0;
+}
+
+void stats_end(int hist, unsigned long long t)
+{
+	if (t)
+		stats_record(hist, now() - t);
+}
+
+/* counting allocator hook: every C++ allocation of the process, Qt's included,
+ * goes through these; ecalloc and erealloc count the C ones of qdmenu */
+void *operator new(size_t size)
+{
+	void *p;
+
+	if (stats) {
+		counters[CntAllocs].fetch_add(1, std::memory_order_relaxed);
+		counters[CntAllocBytes].fetch_add(size, std::memory_order_relaxed);
+	}
+	if (!(p = malloc(size ? size : 1)))
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	try {
+		return operator new(size);
+	} catch (...) {
+		return NULL;
+	}
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
@@ -0,0 +1,31 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Runtime statistics, enabled by stats_init. Histograms are log-linear with
+ * 16 sub-buckets per power of two (about 6% precision), counters are plain
+ * totals. A summary is written to the given file ("-" for stderr) at exit. */
+enum {
+	StatMatch, StatCalcoffsets, StatDrawmenu, StatPaint, /* latency in ns */
+	StatKey,                                             /* key event to painted result, in ns */
+	StatScanned, StatMatches,                            /* items per query */
+	HistLast
+};
+enum {
+	CntTileHit, CntTileMiss, CntPreviewHit, CntPreviewMiss,
+	CntSpecHit, CntSpecMiss,                             /* queries matched ahead of time */
+	CntStratScan, CntStratParallel, CntStratIndex,       /* queries per match strategy */
+	CntAllocs, CntAllocBytes,
+	CntLast
+};
+
+extern int stats;
+
+void stats_init(const char *path);
+void stats_record(int hist, unsigned long long value);
+void stats_count(int counter, unsigned long long n);
+/* value below which fraction p of the recorded values lie */
+unsigned long long stats_percentile(int hist, double p);
+
+/* time a section: t = stats_begin(); ...; stats_end(StatMatch, t);
+ * both are no-ops while stats are disabled */
+unsigned long long stats_begin(void);
+void stats_end(int hist, unsigned long long t);
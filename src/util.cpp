@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "stats.h"
 #include "util.h"
 
 void
@@ -32,5 +33,17 @@ ecalloc(size_t nmemb, size_t size)
 
 	if (!(p = calloc(nmemb, size)))
 		die("calloc:");
+	stats_count(CntAllocs, 1);
+	stats_count(CntAllocBytes, nmemb * size);
+	return p;
+}
+
+void *
+erealloc(void *p, size_t size)
+{
+	if (!(p = realloc(p, size)))
+		die("cannot realloc %zu bytes:", size);
+	stats_count(CntAllocs, 1);
+	stats_count(CntAllocBytes, size);
 	return p;
 }
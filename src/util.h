@@ -6,4 +6,6 @@
 #define LENGTH(X)               (sizeof (X) / sizeof (X)[0])
 
 void die(const char *fmt, ...);
+/* allocations that die on failure, counted in the stats */
 void *ecalloc(size_t nmemb, size_t size);
+void *erealloc(void *p, size_t size);
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Regular expression prefilter check: regex.sh qdmenu
+# Each pattern must match the same items as when wrapped in a group, which
+# turns the literal prefilter off, so only QRegularExpression decides.
+qdmenu=$1
+items=$(printf 'aAb\na41b\nx\001y\nA\n01\nb\nbe\n\303\251\nabc\nABC\nCAF\303\211\n\342\204\252ilo\n\305\277un\n')
+status=0
+
+check() {
+	got=$(printf '%s\n' "$items" | "$qdmenu" "$@" -F "$pat" | sort)
+	want=$(printf '%s\n' "$items" | "$qdmenu" "$@" -F "(?:$pat)" | sort)
+	if [ "$got" != "$want" ]; then
+		printf 'regex %s %s: got "%s", want "%s"\n' "$*" "$pat" "$got" "$want" >&2
+		status=1
+	fi
+}
+
+for pat in 'a\x41b' '\cA' '\101' 'bé?' '(?i)ABC' 'a\x{41}b' '\Qa\E\x41'; do
+	check -r
+done
+# -i folds all of Unicode, the prefilter only ASCII
+for pat in 'café' 'kilo' 'sun' 'abc' 'é'; do
+	check -r -i
+done
+exit $status
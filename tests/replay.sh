@@ -0,0 +1,11 @@
+#!/bin/sh
+# Key latency check on a generated corpus: replay.sh qdmenu items p50:p99 [option...]
+# Items are "x" and a zero padded number, so the queries the replay (see
+# replay() in qdmenu.cpp) types from the start of an item find prefix
+# matches and those typed from its second character only substring ones.
+qdmenu=$1
+n=$2
+limits=$3
+shift 3
+
+seq -f 'x%08.0f' 1 "$n" | QT_QPA_PLATFORM=offscreen "$qdmenu" -T "$limits" "$@"